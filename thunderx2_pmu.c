@@ -8,8 +8,58 @@
 #include <linux/acpi.h>
 #include <linux/cpuhotplug.h>
 #include <linux/arm-smccc.h>
+#include <linux/debugfs.h>
+#include <linux/kallsyms.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/module.h>
 #include <linux/perf_event.h>
 #include <linux/platform_device.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+/* Multi instance CPU hotplug states are available from 4.8 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+#define TX2_PMU_HOTPLUG
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
+#define cpus_read_lock()	get_online_cpus()
+#define cpus_read_unlock()	put_online_cpus()
+#endif
+
+/* Files without the debugfs proxy, which does not forward mmap, from 4.7 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 7, 0)
+#define debugfs_create_file_unsafe	debugfs_create_file
+#endif
+
+#ifndef for_each_sibling_event
+#define for_each_sibling_event(sibling, event)			\
+	list_for_each_entry((sibling), &(event)->sibling_list, group_entry)
+#endif
+
+/*
+ * perf_event_update_userpage() is not exported before 5.0, it is looked
+ * up at module init and the user page is not updated if not found.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 0, 0)
+#define TX2_PMU_USERPAGE_LOOKUP
+static void (*tx2_perf_event_update_userpage)(struct perf_event *event);
+#define perf_event_update_userpage(event)				\
+	do {								\
+		if (tx2_perf_event_update_userpage)			\
+			tx2_perf_event_update_userpage(event);		\
+	} while (0)
+#endif
+
+/* Only events mapped by user space have a user page to update */
+static inline void tx2_event_update_userpage(struct perf_event *event)
+{
+	if (atomic_read(&event->mmap_count))
+		perf_event_update_userpage(event);
+}
 
 /* Each ThunderX2(TX2) Socket has a L3C and DMC UNCORE PMU device.
  * Each UNCORE PMU device consists of 4 independent programmable counters.
@@ -22,8 +72,25 @@
 #define TX2_PMU_L3_TILES		16
 
 #define TX2_PMU_HRTIMER_INTERVAL	(2 * NSEC_PER_SEC)
+#define TX2_PMU_HRTIMER_INTERVAL_MIN	(10 * NSEC_PER_MSEC)
+#define TX2_PMU_HRTIMER_INTERVAL_LIMIT	(3600 * NSEC_PER_SEC)
+#define TX2_PMU_MUX_INTERVAL_MS		100
+
+/*
+ * Maximum clock rates, counters advance by at most one per clock. The DMC
+ * clock is measured by cnt_cycles, once counted.
+ */
+#define TX2_PMU_L3C_CLOCK_MAX_HZ	3000000000ULL
+#define TX2_PMU_DMC_CLOCK_MAX_HZ	1600000000ULL
 #define GET_EVENTID(ev)			((ev->hw.config) & 0x1f)
-#define GET_COUNTERID(ev)		((ev->hw.idx) & 0x3)
+#define GET_CHANNELID(ev)		(((ev->hw.config) >> 8) & 0xf)
+#define GET_METRIC(ev)			(((ev->hw.config) >> 5) & 0x7)
+#define GET_SCOPE(ev)			(((ev->hw.config) >> 12) & 0x3)
+#define GET_COUNTER(ev)			(((ev->hw.config) >> 14) & 0x3)
+#define GET_PIN(ev)			(((ev->hw.config) >> 16) & 0x1)
+#define GET_HIST(ev)			(((ev->hw.config) >> 17) & 0x1)
+#define TX2_PMU_CONFIG_MASK		(GENMASK(17, 5) | 0x1f)
+#define TX2_PMU_COUNTER_MASK		GENMASK(31, 0)
  /* 1 byte per counter(4 counters).
   * Event id is encoded in bits [5:1] of a byte,
   */
@@ -52,12 +119,76 @@
 #define DMC_EVENT_READ_TXNS		0xF
 #define DMC_EVENT_MAX			0x10
 
+/* Derived metrics, computed from up to 2 hardware events */
+#define TX2_PMU_METRIC_EVENTS		2
+#define TX2_PMU_RATIO_SCALE		10000
+
+#define L3_METRIC_READ_HIT_RATIO	0x1
+#define L3_METRIC_MAX			0x2
+
+#define DMC_METRIC_READ_BYTES		0x1
+#define DMC_METRIC_WRITE_BYTES		0x2
+#define DMC_METRIC_BYTES		0x3
+#define DMC_METRIC_MAX			0x4
+
+/*
+ * DMC events of the attribution PMU, counted by a source event per socket.
+ * The shares of the source traffic are summed up in 1/2^10 units.
+ */
+#define TX2_ATTRIB_EVENTS		2
+#define TX2_ATTRIB_SHIFT		10
+
 /* SMC calls */
 #define THUNDERX2_SMC_CALL_ID		0xC200FF00
 #define L3C_STARTSTOP_COUNTER	0xB0B0
 #define L3C_READ_COUNTER	0xB0B1
 #define DMC_STARTSTOP_COUNTER	0xB0B2
 #define DMC_READ_COUNTER	0xB0B3
+#define L3C_READ_ALL_COUNTERS	0xB0B4
+#define DMC_READ_ALL_COUNTERS	0xB0B5
+#define L3C_STARTSTOP_COUNTERS	0xB0B6
+#define DMC_STARTSTOP_COUNTERS	0xB0B7
+#define SELECT_CHANNEL		0xB010
+
+static bool l3c_mmio;
+module_param(l3c_mmio, bool, 0444);
+MODULE_PARM_DESC(l3c_mmio, "Access L3C counters through MMIO instead of SMC calls");
+
+static bool dmc_mmio;
+module_param(dmc_mmio, bool, 0444);
+MODULE_PARM_DESC(dmc_mmio, "Access DMC counters through MMIO instead of SMC calls");
+
+static unsigned int emulate;
+module_param(emulate, uint, 0444);
+MODULE_PARM_DESC(emulate, "Register emulated PMUs, without hardware access, on the first N nodes");
+
+static unsigned long emulate_rate = 1000000000;
+module_param(emulate_rate, ulong, 0644);
+MODULE_PARM_DESC(emulate_rate, "Events per second counted by every emulated counter");
+
+static char *housekeeping_cpus;
+module_param(housekeeping_cpus, charp, 0444);
+MODULE_PARM_DESC(housekeeping_cpus, "CPUs preferred to own the PMUs of their socket (cpu list)");
+
+static bool sample_in_work;
+module_param(sample_in_work, bool, 0444);
+MODULE_PARM_DESC(sample_in_work, "Read the counters from a work item instead of the hrtimer interrupt");
+
+static unsigned int timer_slack_us;
+module_param(timer_slack_us, uint, 0644);
+MODULE_PARM_DESC(timer_slack_us, "Slack of the sampling hrtimer, up to half the interval (us)");
+
+static bool lazy_sampling;
+module_param(lazy_sampling, bool, 0444);
+MODULE_PARM_DESC(lazy_sampling, "Read counters only before they may wrap at their maximum rate");
+
+static unsigned int snapshot_entries;
+module_param(snapshot_entries, uint, 0444);
+MODULE_PARM_DESC(snapshot_entries, "Entries of the debugfs snapshot ring (0 disables)");
+
+static bool attribution;
+module_param(attribution, bool, 0444);
+MODULE_PARM_DESC(attribution, "Register the per CPU DMC bandwidth attribution PMU");
 
 enum tx2_uncore_type {
 	PMU_TYPE_L3C,
@@ -65,6 +196,172 @@ enum tx2_uncore_type {
 	PMU_TYPE_INVALID,
 };
 
+/* Channels(DMC) or tiles(L3C) counted by an event */
+enum tx2_uncore_scope {
+	EVENT_SCOPE_PRORATE,	/* selected channel, prorated to the device */
+	EVENT_SCOPE_CHANNEL,	/* selected channel only */
+	EVENT_SCOPE_ALL,	/* sum of all channels */
+};
+
+enum tx2_metric_type {
+	METRIC_TYPE_SUM,	/* sum of the events, times mult */
+	METRIC_TYPE_RATIO,	/* events[0] / events[1] */
+};
+
+struct tx2_uncore_metric {
+	enum tx2_metric_type type;
+	u32 nr_events;
+	u32 events[TX2_PMU_METRIC_EVENTS];
+	u32 mult;
+};
+
+/* Total of each event of a ratio metric, the event count is the ratio */
+struct tx2_metric_state {
+	local64_t count[TX2_PMU_METRIC_EVENTS];
+};
+
+/* Bucket n > 0 of a rate histogram counts rates in [2^(n-1), 2^n) */
+#define TX2_HIST_BUCKETS		64
+
+/* Rate of an event over the timer intervals, in events per second */
+struct tx2_hist_state {
+	struct list_head entry;
+	struct perf_event *event;
+	u64 prev_count;
+	u64 prev_time;
+	u64 intervals;
+	u64 max_rate;
+	u64 hist[TX2_HIST_BUCKETS];
+};
+
+/*
+ * Snapshot of the counts of a PMU, taken at every timer tick. The
+ * entry is being written while seq is odd.
+ */
+struct tx2_snapshot_entry {
+	u32 seq;
+	u16 node;
+	u8 type;
+	u8 counters;			/* bitmap of the valid counters */
+	u64 time;			/* ktime_get_ns() */
+	u32 config[TX2_PMU_MAX_COUNTERS];	/* perf event config */
+	u64 count[TX2_PMU_MAX_COUNTERS];	/* perf event count */
+};
+
+/*
+ * Ring of snapshots of all PMUs, mapped read-only to user space.
+ * head is the number of entries written, the latest one is at
+ * (head - 1) % nr_entries.
+ */
+struct tx2_snapshot_ring {
+	u32 version;
+	u32 nr_entries;
+	u64 head;
+	u64 reserved[6];
+	struct tx2_snapshot_entry entries[];
+};
+
+#define TX2_SNAPSHOT_VERSION		1
+
+/*
+ * State of the counters of an MMIO PMU as of their last read, mapped
+ * read-only to user space along with the page of the channel 0 registers.
+ * The state is being written while seq is odd.
+ */
+struct tx2_user_counter {
+	u32 active;
+	u32 config;			/* perf event config */
+	u32 reg;			/* offset of the counter register */
+	u32 raw;			/* counter register value */
+	u64 count;			/* perf event count */
+};
+
+struct tx2_user_state {
+	u32 seq;
+	u32 prorate;			/* factor of prorated events */
+	struct tx2_user_counter counters[TX2_PMU_MAX_COUNTERS];
+};
+
+/*
+ * The state and registers mapped by user space, referenced by the PMU and
+ * its open state and regs files: the mappings outlive the PMU.
+ */
+struct tx2_user_map {
+	struct kref ref;
+	struct tx2_user_state *state;
+	phys_addr_t chan_phys;
+};
+
+/*
+ * Consecutive read failures of an SMC counter before it is given up on,
+ * and of the batched read before it is no longer used.
+ */
+#define TX2_SMC_MAX_ERRORS		8
+
+/* Histogram bucket n counts durations below 256ns << n, the last the rest */
+#define TX2_STAT_BUCKETS		16
+
+enum tx2_smc_stat {
+	TX2_SMC_STARTSTOP,
+	TX2_SMC_READ,
+	TX2_SMC_READ_ALL,
+	TX2_SMC_STARTSTOP_ALL,
+	TX2_SMC_SELECT,
+	TX2_SMC_STATS,
+};
+
+static const char *const tx2_smc_stat_names[TX2_SMC_STATS] = {
+	[TX2_SMC_STARTSTOP]	= "smc_startstop",
+	[TX2_SMC_READ]		= "smc_read",
+	[TX2_SMC_READ_ALL]	= "smc_read_all",
+	[TX2_SMC_STARTSTOP_ALL]	= "smc_startstop_all",
+	[TX2_SMC_SELECT]	= "smc_select",
+};
+
+/* Call count and duration of an operation, reported in debugfs */
+struct tx2_uncore_stat {
+	u64 calls;
+	u64 failures;
+	u64 total_ns;
+	u64 max_ns;
+	u64 hist[TX2_STAT_BUCKETS];
+};
+
+/*
+ * The uncore devices of a socket are owned by the same CPU and sampled
+ * by a single timer.
+ */
+struct tx2_uncore_node {
+	struct list_head entry;
+	int node;
+	int cpu;
+	u64 hrtimer_interval;
+	ktime_t last_sample;
+	struct hrtimer hrtimer;
+	struct work_struct work;
+	struct tx2_uncore_pmu *pmus[PMU_TYPE_INVALID];
+	/* sampling cost and timer expiry latency, missed timer periods */
+	struct tx2_uncore_stat sample_stat;
+	struct tx2_uncore_stat timer_latency;
+	u64 timer_overruns;
+};
+
+/*
+ * Counter access backend of a PMU, called with the PMU lock held.
+ * read_counter returns the count since the previous read. reset_counter
+ * and startstop_counters, starting or stopping the counters of @mask, for
+ * their cntr_last events, at once and failing if not supported, are
+ * optional.
+ */
+struct tx2_uncore_ops {
+	void (*stop_event)(struct perf_event *event, int idx);
+	void (*start_event)(struct perf_event *event, int idx, u32 event_id);
+	u64 (*read_counter)(struct perf_event *event, int idx);
+	void (*reset_counter)(struct perf_event *event, int idx);
+	u64 (*startstop_counters)(struct tx2_uncore_pmu *tx2_pmu,
+			unsigned long mask, const u32 *event_ids);
+};
+
 /*
  * pmu on each socket has 2 uncore devices(dmc and l3c),
  * each device has 4 counters.
@@ -75,35 +372,181 @@ struct tx2_uncore_pmu {
 	struct pmu pmu;
 	char *name;
 	int node;
-	int cpu;
+	struct tx2_uncore_node *tx2_node;
 	u32 max_counters;
 	u32 max_events;
-	u64 hrtimer_interval;
-	void __iomem *base;
+	u32 max_metrics;
+	const struct tx2_uncore_metric *metrics;
+	u32 prorate_factor;
+	u32 max_chans;
+	u32 nr_chans;
+	u64 hrtimer_interval_min;
+	u64 hrtimer_interval_max;
+	local64_t sample_count[TX2_PMU_MAX_COUNTERS];
+	u64 last_sync[TX2_PMU_MAX_COUNTERS];
+	u64 clock_hz;
+	bool batch_read;
+	void __iomem *chan_base[TX2_PMU_L3_TILES];
+	/* channels muxed behind one window, and the one selected (-1: unknown) */
+	bool chan_mux;
+	int cur_chan;
+	unsigned long cntr_ctl[TX2_PMU_MAX_COUNTERS];
+	unsigned long cntr_data[TX2_PMU_MAX_COUNTERS];
+	local64_t chan_prev_count[TX2_PMU_MAX_COUNTERS][TX2_PMU_L3_TILES];
 	DECLARE_BITMAP(active_counters, TX2_PMU_MAX_COUNTERS);
 	struct perf_event *events[TX2_PMU_MAX_COUNTERS];
+	/* hardware event and metric event index counted by a counter */
+	u32 cntr_event[TX2_PMU_MAX_COUNTERS];
+	u32 cntr_metric_idx[TX2_PMU_MAX_COUNTERS];
 	struct device *dev;
-	struct hrtimer hrtimer;
 	const struct attribute_group **attr_groups;
 	enum tx2_uncore_type type;
+	/* serializes counter access, aggregate events read from other CPUs */
+	raw_spinlock_t lock;
+	/*
+	 * flags of the current transaction of each CPU, the events are read
+	 * from any CPU of the socket while the owner schedules them
+	 */
+	unsigned int __percpu *txn_flags;
+	/* SMC calls, made with the lock held, or at probe */
+	struct tx2_uncore_stat smc_stats[TX2_SMC_STATS];
+	/*
+	 * consecutive read failures of a counter, when it was last read, or
+	 * started, and when it is read again after failures
+	 */
+	u8 smc_errors[TX2_PMU_MAX_COUNTERS];
+	u64 smc_read_ns[TX2_PMU_MAX_COUNTERS];
+	u64 smc_retry_ns[TX2_PMU_MAX_COUNTERS];
+	u8 batch_errors;
+	DECLARE_BITMAP(failed_counters, TX2_PMU_MAX_COUNTERS);
+	/* socket wide events read by the attribution events */
+	struct perf_event *attrib_src[TX2_ATTRIB_EVENTS];
+	int attrib_users[TX2_ATTRIB_EVENTS];
+	/*
+	 * source count as of the last scheduling of an attribution event,
+	 * the sum of its increases divided by the CPUs running one meanwhile,
+	 * and of those while none ran
+	 */
+	raw_spinlock_t attrib_lock;
+	u64 attrib_count[TX2_ATTRIB_EVENTS];
+	u64 attrib_share[TX2_ATTRIB_EVENTS];
+	u64 attrib_unshared[TX2_ATTRIB_EVENTS];
+	unsigned int attrib_cpus[TX2_ATTRIB_EVENTS];
+	/*
+	 * starts and stops deferred to pmu_enable, see tx2_uncore_pmu_disable,
+	 * the counters changed by the events added and removed meanwhile
+	 */
+	bool deferred;
+	unsigned long pending_start;
+	unsigned long pending_stop;
+	/* event id a counter counts (0 if stopped), the event last started */
+	u32 cntr_programmed[TX2_PMU_MAX_COUNTERS];
+	struct perf_event *cntr_last[TX2_PMU_MAX_COUNTERS];
+	/* emulated counter registers and when they were last advanced */
+	u64 emul_count[TX2_PMU_MAX_COUNTERS];
+	u64 emul_time[TX2_PMU_MAX_COUNTERS];
+	unsigned long emul_running;
+	/* channel 0 registers, and their state mapped by user space */
+	phys_addr_t chan_phys;
+	struct tx2_user_map *user_map;
+	struct tx2_user_state *user_state;
+	struct dentry *debugfs;
+	const struct tx2_uncore_ops *ops;
+};
+
+/*
+ * System wide PMU of a device type, its events are the sum of an event
+ * counted on the PMU of every socket. The events are counted on the CPU
+ * of a host node.
+ */
+struct tx2_uncore_aggr {
+	struct pmu pmu;
+	enum tx2_uncore_type type;
+	int nr_pmus;
+	bool registered;
+	struct tx2_uncore_node *tx2_node;
+};
+
+/* The per socket events summed by an aggregate event */
+struct tx2_aggr_event {
+	bool ratio;
+	int nr_events;
+	struct perf_event *events[];
+};
+
+/* Attribution event, a share of the traffic of the socket of its CPU */
+struct tx2_attrib_event {
+	struct tx2_uncore_pmu *tx2_pmu;
+	int src;
+};
+
+/* Attribution events running on a CPU, per source event */
+struct tx2_attrib_cpu {
+	unsigned int running[TX2_ATTRIB_EVENTS];
 };
 
+/* Counters allocated to an event, more than one for metrics */
+#define for_each_event_counter(idx, tx2_pmu, event)			\
+	for_each_set_bit(idx, (tx2_pmu)->active_counters,		\
+			(tx2_pmu)->max_counters)			\
+		if ((tx2_pmu)->events[idx] == (event))
+
 static LIST_HEAD(tx2_pmus);
+static LIST_HEAD(tx2_nodes);
+#ifdef TX2_PMU_HOTPLUG
+static enum cpuhp_state tx2_uncore_cpuhp_state;
+#endif
+static struct cpumask tx2_housekeeping_mask;
+static DEFINE_MUTEX(tx2_pmu_cpu_lock);
+static struct tx2_uncore_aggr tx2_aggrs[PMU_TYPE_INVALID];
+static struct pmu tx2_attrib_pmu;
+static int tx2_attrib_nr_pmus;
+static bool tx2_attrib_registered;
+static DEFINE_PER_CPU(struct tx2_attrib_cpu, tx2_attrib_cpu);
+static struct dentry *tx2_pmu_debugfs;
+static struct tx2_snapshot_ring *tx2_snapshot_ring;
+static DEFINE_RAW_SPINLOCK(tx2_snapshot_lock);
+static LIST_HEAD(tx2_hist_events);
+static DEFINE_MUTEX(tx2_hist_lock);
 
 static inline struct tx2_uncore_pmu *pmu_to_tx2_pmu(struct pmu *pmu)
 {
 	return container_of(pmu, struct tx2_uncore_pmu, pmu);
 }
 
+static inline struct tx2_uncore_aggr *pmu_to_tx2_aggr(struct pmu *pmu)
+{
+	return container_of(pmu, struct tx2_uncore_aggr, pmu);
+}
+
 PMU_FORMAT_ATTR(event,	"config:0-4");
+PMU_FORMAT_ATTR(metric,	"config:5-7");
+PMU_FORMAT_ATTR(channel,	"config:8-10");
+PMU_FORMAT_ATTR(tile,	"config:8-11");
+PMU_FORMAT_ATTR(scope,	"config:12-13");
+PMU_FORMAT_ATTR(counter,	"config:14-15");
+PMU_FORMAT_ATTR(pin,	"config:16");
+PMU_FORMAT_ATTR(hist,	"config:17");
 
 static struct attribute *l3c_pmu_format_attrs[] = {
 	&format_attr_event.attr,
+	&format_attr_metric.attr,
+	&format_attr_tile.attr,
+	&format_attr_scope.attr,
+	&format_attr_counter.attr,
+	&format_attr_pin.attr,
+	&format_attr_hist.attr,
 	NULL,
 };
 
 static struct attribute *dmc_pmu_format_attrs[] = {
 	&format_attr_event.attr,
+	&format_attr_metric.attr,
+	&format_attr_channel.attr,
+	&format_attr_scope.attr,
+	&format_attr_counter.attr,
+	&format_attr_pin.attr,
+	&format_attr_hist.attr,
 	NULL,
 };
 
@@ -118,560 +561,3155 @@ static const struct attribute_group dmc_pmu_format_attr_group = {
 };
 
 /*
- * sysfs event attributes
+ * sysfs event attributes, generated at init from the event tables, with
+ * optional .scale, .unit and .snapshot attributes.
  */
-static ssize_t tx2_pmu_event_show(struct device *dev,
-				    struct device_attribute *attr, char *buf)
-{
-	struct dev_ext_attribute *eattr;
+struct tx2_uncore_event_desc {
+	const char *name;
+	const char *config;
+	const char *scale_name;
+	const char *scale;
+	const char *unit_name;
+	const char *unit;
+	const char *snapshot_name;
+};
 
-	eattr = container_of(attr, struct dev_ext_attribute, attr);
-	return sprintf(buf, "event=0x%lx\n", (unsigned long) eattr->var);
-}
+#define TX2_DESC(_name, _config, _scale, _unit) \
+	{ .name = #_name, .config = _config, \
+	  .scale_name = #_name ".scale", .scale = _scale, \
+	  .unit_name = #_name ".unit", .unit = _unit }
 
-#define TX2_EVENT_ATTR(name, config) \
-	PMU_EVENT_ATTR(name, tx2_pmu_event_attr_##name, \
-			config, tx2_pmu_event_show)
+#define TX2_EVENT_DESC(_name, _id) \
+	{ .name = #_name, .config = "event=" __stringify(_id) }
 
-TX2_EVENT_ATTR(read_request, L3_EVENT_READ_REQ);
-TX2_EVENT_ATTR(writeback_request, L3_EVENT_WRITEBACK_REQ);
-TX2_EVENT_ATTR(inv_nwrite_request, L3_EVENT_INV_N_WRITE_REQ);
-TX2_EVENT_ATTR(inv_request, L3_EVENT_INV_REQ);
-TX2_EVENT_ATTR(evict_request, L3_EVENT_EVICT_REQ);
-TX2_EVENT_ATTR(inv_nwrite_hit, L3_EVENT_INV_N_WRITE_HIT);
-TX2_EVENT_ATTR(inv_hit, L3_EVENT_INV_HIT);
-TX2_EVENT_ATTR(read_hit, L3_EVENT_READ_HIT);
+/* Events counting 64 or 16 byte units, reported in bytes */
+#define TX2_EVENT_DESC_BYTES(_name, _id, _scale) \
+	TX2_DESC(_name, "event=" __stringify(_id), _scale, "Bytes")
 
-static struct attribute *l3c_pmu_events_attrs[] = {
-	&tx2_pmu_event_attr_read_request.attr.attr,
-	&tx2_pmu_event_attr_writeback_request.attr.attr,
-	&tx2_pmu_event_attr_inv_nwrite_request.attr.attr,
-	&tx2_pmu_event_attr_inv_request.attr.attr,
-	&tx2_pmu_event_attr_evict_request.attr.attr,
-	&tx2_pmu_event_attr_inv_nwrite_hit.attr.attr,
-	&tx2_pmu_event_attr_inv_hit.attr.attr,
-	&tx2_pmu_event_attr_read_hit.attr.attr,
-	NULL,
+#define TX2_METRIC_DESC(_name, _metric, _scale, _unit) \
+	TX2_DESC(_name, "metric=" __stringify(_metric), _scale, _unit)
+
+/*
+ * Ratio metrics count the ratio since the event was enabled, perf stat -I
+ * reports the count of a snapshot event as is, not its increase.
+ */
+#define TX2_RATIO_DESC(_name, _metric, _scale, _unit) \
+	{ .name = #_name, .config = "metric=" __stringify(_metric), \
+	  .scale_name = #_name ".scale", .scale = _scale, \
+	  .unit_name = #_name ".unit", .unit = _unit, \
+	  .snapshot_name = #_name ".snapshot" }
+
+/* L3C requests are for a cache line */
+static const struct tx2_uncore_event_desc l3c_events[] = {
+	TX2_EVENT_DESC_BYTES(read_request, L3_EVENT_READ_REQ, "64"),
+	TX2_EVENT_DESC_BYTES(writeback_request, L3_EVENT_WRITEBACK_REQ, "64"),
+	TX2_EVENT_DESC_BYTES(inv_nwrite_request, L3_EVENT_INV_N_WRITE_REQ,
+			"64"),
+	TX2_EVENT_DESC_BYTES(inv_request, L3_EVENT_INV_REQ, "64"),
+	TX2_EVENT_DESC_BYTES(evict_request, L3_EVENT_EVICT_REQ, "64"),
+	TX2_EVENT_DESC_BYTES(inv_nwrite_hit, L3_EVENT_INV_N_WRITE_HIT, "64"),
+	TX2_EVENT_DESC_BYTES(inv_hit, L3_EVENT_INV_HIT, "64"),
+	TX2_EVENT_DESC_BYTES(read_hit, L3_EVENT_READ_HIT, "64"),
+	TX2_RATIO_DESC(l3_read_hit_ratio, L3_METRIC_READ_HIT_RATIO,
+			"0.01", "%"),
 };
 
-TX2_EVENT_ATTR(cnt_cycles, DMC_EVENT_COUNT_CYCLES);
-TX2_EVENT_ATTR(write_txns, DMC_EVENT_WRITE_TXNS);
-TX2_EVENT_ATTR(data_transfers, DMC_EVENT_DATA_TRANSFERS);
-TX2_EVENT_ATTR(read_txns, DMC_EVENT_READ_TXNS);
+/* DMC transactions are 64 bytes, data transfers 16 bytes */
+static const struct tx2_uncore_event_desc dmc_events[] = {
+	TX2_EVENT_DESC(cnt_cycles, DMC_EVENT_COUNT_CYCLES),
+	TX2_EVENT_DESC_BYTES(write_txns, DMC_EVENT_WRITE_TXNS, "64"),
+	TX2_EVENT_DESC_BYTES(data_transfers, DMC_EVENT_DATA_TRANSFERS, "16"),
+	TX2_EVENT_DESC_BYTES(read_txns, DMC_EVENT_READ_TXNS, "64"),
+	TX2_METRIC_DESC(dmc_read_bw_bytes, DMC_METRIC_READ_BYTES,
+			"1", "Bytes"),
+	TX2_METRIC_DESC(dmc_write_bw_bytes, DMC_METRIC_WRITE_BYTES,
+			"1", "Bytes"),
+	TX2_METRIC_DESC(dmc_bw_bytes, DMC_METRIC_BYTES, "1", "Bytes"),
+};
 
-static struct attribute *dmc_pmu_events_attrs[] = {
-	&tx2_pmu_event_attr_cnt_cycles.attr.attr,
-	&tx2_pmu_event_attr_write_txns.attr.attr,
-	&tx2_pmu_event_attr_data_transfers.attr.attr,
-	&tx2_pmu_event_attr_read_txns.attr.attr,
-	NULL,
+static const struct tx2_uncore_event_desc dmc_attrib_event_descs[] = {
+	TX2_EVENT_DESC_BYTES(write_txns, DMC_EVENT_WRITE_TXNS, "64"),
+	TX2_EVENT_DESC_BYTES(read_txns, DMC_EVENT_READ_TXNS, "64"),
 };
 
-static const struct attribute_group l3c_pmu_events_attr_group = {
-	.name = "events",
-	.attrs = l3c_pmu_events_attrs,
+static const u32 dmc_attrib_events[TX2_ATTRIB_EVENTS] = {
+	DMC_EVENT_READ_TXNS,
+	DMC_EVENT_WRITE_TXNS,
 };
 
-static const struct attribute_group dmc_pmu_events_attr_group = {
-	.name = "events",
-	.attrs = dmc_pmu_events_attrs,
+static struct attribute *dmc_attrib_format_attrs[] = {
+	&format_attr_event.attr,
+	NULL,
 };
 
 /*
- * sysfs cpumask attributes
+ * L3C cache hit ratio of read requests, the ratio including the
+ * invalidate requests needs 6 events, more than the 4 counters.
  */
-static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr,
-		char *buf)
-{
-	struct tx2_uncore_pmu *tx2_pmu;
+static const struct tx2_uncore_metric l3c_metrics[L3_METRIC_MAX] = {
+	[L3_METRIC_READ_HIT_RATIO] = {
+		.type = METRIC_TYPE_RATIO,
+		.nr_events = 2,
+		.events = { L3_EVENT_READ_HIT, L3_EVENT_READ_REQ },
+	},
+};
 
-	tx2_pmu = pmu_to_tx2_pmu(dev_get_drvdata(dev));
-	return cpumap_print_to_pagebuf(true, buf, cpumask_of(tx2_pmu->cpu));
-}
-static DEVICE_ATTR_RO(cpumask);
+/* DMC transactions are 64 bytes */
+static const struct tx2_uncore_metric dmc_metrics[DMC_METRIC_MAX] = {
+	[DMC_METRIC_READ_BYTES] = {
+		.type = METRIC_TYPE_SUM,
+		.nr_events = 1,
+		.events = { DMC_EVENT_READ_TXNS },
+		.mult = 64,
+	},
+	[DMC_METRIC_WRITE_BYTES] = {
+		.type = METRIC_TYPE_SUM,
+		.nr_events = 1,
+		.events = { DMC_EVENT_WRITE_TXNS },
+		.mult = 64,
+	},
+	[DMC_METRIC_BYTES] = {
+		.type = METRIC_TYPE_SUM,
+		.nr_events = 2,
+		.events = { DMC_EVENT_READ_TXNS, DMC_EVENT_WRITE_TXNS },
+		.mult = 64,
+	},
+};
 
-static struct attribute *tx2_pmu_cpumask_attrs[] = {
-	&dev_attr_cpumask.attr,
-	NULL,
+/* attrs are set by tx2_uncore_events_init */
+static struct attribute_group l3c_pmu_events_attr_group = {
+	.name = "events",
 };
 
-static const struct attribute_group pmu_cpumask_attr_group = {
-	.attrs = tx2_pmu_cpumask_attrs,
+static struct attribute_group dmc_pmu_events_attr_group = {
+	.name = "events",
 };
 
-/*
- * Per PMU device attribute groups
- */
-static const struct attribute_group *l3c_pmu_attr_groups[] = {
-	&l3c_pmu_format_attr_group,
-	&pmu_cpumask_attr_group,
-	&l3c_pmu_events_attr_group,
-	NULL
+static const struct attribute_group dmc_attrib_format_attr_group = {
+	.name = "format",
+	.attrs = dmc_attrib_format_attrs,
 };
 
-static const struct attribute_group *dmc_pmu_attr_groups[] = {
-	&dmc_pmu_format_attr_group,
-	&pmu_cpumask_attr_group,
-	&dmc_pmu_events_attr_group,
-	NULL
+static struct attribute_group dmc_attrib_events_attr_group = {
+	.name = "events",
 };
 
-static inline u32 reg_readl(unsigned long addr)
+static void tx2_events_attr_init(struct perf_pmu_events_attr *pattr,
+		const char *name, const char *str)
 {
-	return readl((void __iomem *)addr);
+	sysfs_attr_init(&pattr->attr.attr);
+	pattr->attr.attr.name = name;
+	pattr->attr.attr.mode = 0444;
+	pattr->attr.show = perf_event_sysfs_show;
+	pattr->event_str = str;
 }
 
-static inline void reg_writel(u32 val, unsigned long addr)
+/* Build the NULL terminated attributes of the @nr events of @desc */
+static struct attribute **tx2_events_attrs(
+		const struct tx2_uncore_event_desc *desc, int nr)
 {
-	writel(val, (void __iomem *)addr);
+	struct perf_pmu_events_attr *pattr;
+	struct attribute **attrs;
+	int i, n = 0;
+
+	attrs = kcalloc(4 * nr + 1, sizeof(*attrs), GFP_KERNEL);
+	pattr = kcalloc(4 * nr, sizeof(*pattr), GFP_KERNEL);
+	if (!attrs || !pattr) {
+		kfree(attrs);
+		kfree(pattr);
+		return NULL;
+	}
+
+	for (i = 0; i < nr; i++) {
+		tx2_events_attr_init(&pattr[n], desc[i].name, desc[i].config);
+		attrs[n] = &pattr[n].attr.attr;
+		n++;
+		if (desc[i].scale) {
+			tx2_events_attr_init(&pattr[n], desc[i].scale_name,
+					desc[i].scale);
+			attrs[n] = &pattr[n].attr.attr;
+			n++;
+		}
+		if (desc[i].unit) {
+			tx2_events_attr_init(&pattr[n], desc[i].unit_name,
+					desc[i].unit);
+			attrs[n] = &pattr[n].attr.attr;
+			n++;
+		}
+		if (desc[i].snapshot_name) {
+			tx2_events_attr_init(&pattr[n], desc[i].snapshot_name,
+					"1");
+			attrs[n] = &pattr[n].attr.attr;
+			n++;
+		}
+	}
+	return attrs;
 }
 
-static int alloc_counter(struct tx2_uncore_pmu *tx2_pmu)
+static void tx2_events_attrs_free(struct attribute_group *group)
 {
-	int counter;
+	struct attribute **attrs = group->attrs;
 
-	counter = find_first_zero_bit(tx2_pmu->active_counters,
-				tx2_pmu->max_counters);
-	if (counter == tx2_pmu->max_counters)
-		return -ENOSPC;
+	if (!attrs)
+		return;
+	kfree(container_of(attrs[0], struct perf_pmu_events_attr,
+				attr.attr));
+	kfree(attrs);
+	group->attrs = NULL;
+}
 
-	set_bit(counter, tx2_pmu->active_counters);
-	return counter;
+static void tx2_uncore_events_exit(void)
+{
+	tx2_events_attrs_free(&l3c_pmu_events_attr_group);
+	tx2_events_attrs_free(&dmc_pmu_events_attr_group);
+	tx2_events_attrs_free(&dmc_attrib_events_attr_group);
 }
 
-static inline void free_counter(struct tx2_uncore_pmu *tx2_pmu, int counter)
+static int tx2_uncore_events_init(void)
 {
-	clear_bit(counter, tx2_pmu->active_counters);
+	l3c_pmu_events_attr_group.attrs =
+		tx2_events_attrs(l3c_events, ARRAY_SIZE(l3c_events));
+	dmc_pmu_events_attr_group.attrs =
+		tx2_events_attrs(dmc_events, ARRAY_SIZE(dmc_events));
+	dmc_attrib_events_attr_group.attrs =
+		tx2_events_attrs(dmc_attrib_event_descs,
+				ARRAY_SIZE(dmc_attrib_event_descs));
+
+	if (!l3c_pmu_events_attr_group.attrs ||
+	    !dmc_pmu_events_attr_group.attrs ||
+	    !dmc_attrib_events_attr_group.attrs) {
+		tx2_uncore_events_exit();
+		return -ENOMEM;
+	}
+	return 0;
 }
 
 /*
- *
- *  SMC call arguments,
- *	x0 = THUNDERX2_SMC_CALL_ID	(Vendor SMC call Id)
- *	x1 = L3C_STARTSTOP_COUNTER/DMC_STARTSTOP_COUNTER
- *	x2 = Node id
- *	x3 = counter id
- *	x4 = stop(0)/event_id
- *
- *	return a0 = 0 success
+ * Pick an online CPU of the node to own a PMU, other than @exclude,
+ * preferring the housekeeping CPUs.
  */
-static u64 tx2_pmu_startstop_counter(struct perf_event *event, bool startstop)
+static int tx2_uncore_pick_cpu(int node, int exclude)
 {
-	struct arm_smccc_res res;
-	int counter_id = GET_COUNTERID(event);
-	int event_id = GET_EVENTID(event);
-
-	struct tx2_uncore_pmu *tx2_pmu;
-	enum tx2_uncore_type type;
+	int cpu;
 
-	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
-	type = tx2_pmu->type;
+	for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+		if (cpu != exclude &&
+		    cpumask_test_cpu(cpu, &tx2_housekeeping_mask))
+			return cpu;
+	}
 
-	arm_smccc_smc(THUNDERX2_SMC_CALL_ID,
-			type ?  DMC_STARTSTOP_COUNTER : L3C_STARTSTOP_COUNTER,
-			tx2_pmu->node, counter_id,
-			startstop ? event_id : startstop, 0, 0, 0, &res);
-	if (res.a0) {
-		dev_err(tx2_pmu->dev,
-			"SMC to Select channel failed for PMU UNCORE[%s]\n",
-				tx2_pmu->name);
+	for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+		if (cpu != exclude)
+			return cpu;
 	}
-	return res.a0;
+
+	return nr_cpu_ids;
+}
+
+/* Stop sampling, the timer and the work item rearm each other */
+static void tx2_uncore_node_cancel(struct tx2_uncore_node *tx2_node)
+{
+	hrtimer_cancel(&tx2_node->hrtimer);
+	cancel_work_sync(&tx2_node->work);
+	hrtimer_cancel(&tx2_node->hrtimer);
 }
 
 /*
- *
- *  SMC call arguments,
- *	x0 = THUNDERX2_SMC_CALL_ID	(Vendor SMC call Id)
- *	x1 = THUNDERX2_SMC_READ_COUNTER
- *	x2 = Node id
- *	x3 = counter id
- *
- *	return a0 = 0 success
- *	return a1 = counter value
+ * Move the PMUs of the node to @new_cpu, events are restarted, and so is
+ * the hrtimer, on the new CPU. Called with CPU hotplug excluded and
+ * tx2_pmu_cpu_lock held.
  */
-static u64 tx2_pmu_read_counter(struct perf_event *event)
+static void tx2_uncore_node_migrate(struct tx2_uncore_node *tx2_node,
+		int new_cpu)
 {
-	struct arm_smccc_res res;
-	int counter_id = GET_COUNTERID(event);
+	int i, cpu = tx2_node->cpu;
 
-	struct tx2_uncore_pmu *tx2_pmu;
-	enum tx2_uncore_type type;
+	if (new_cpu == cpu)
+		return;
 
-	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
-	type = tx2_pmu->type;
+	tx2_uncore_node_cancel(tx2_node);
+	tx2_node->cpu = new_cpu;
+	if (cpu >= nr_cpu_ids || new_cpu >= nr_cpu_ids)
+		return;
 
-	arm_smccc_smc(THUNDERX2_SMC_CALL_ID, type ?
-			DMC_READ_COUNTER : L3C_READ_COUNTER,
-			tx2_pmu->node, counter_id, 0, 0, 0, 0, &res);
-	if (res.a0) {
-		dev_err(tx2_pmu->dev,
-			"SMC to Select channel failed for PMU UNCORE[%s]\n",
-				tx2_pmu->name);
-		return 0;
+	for (i = 0; i < PMU_TYPE_INVALID; i++) {
+		if (tx2_node->pmus[i])
+			perf_pmu_migrate_context(&tx2_node->pmus[i]->pmu,
+					cpu, new_cpu);
+		if (tx2_aggrs[i].registered &&
+		    tx2_aggrs[i].tx2_node == tx2_node)
+			perf_pmu_migrate_context(&tx2_aggrs[i].pmu,
+					cpu, new_cpu);
 	}
+}
+
+/*
+ * sysfs cpumask attributes
+ */
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr,
+		char *buf)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
 
-	return res.a1;
+	tx2_pmu = pmu_to_tx2_pmu(dev_get_drvdata(dev));
+	return cpumap_print_to_pagebuf(true, buf,
+			cpumask_of(tx2_pmu->tx2_node->cpu));
 }
 
-static void tx2_uncore_event_update(struct perf_event *event)
+/*
+ * Writing a CPU number of the same node moves the PMUs of the node to
+ * that CPU
+ */
+static ssize_t cpumask_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
 {
-	s64 new = 0;
 	struct tx2_uncore_pmu *tx2_pmu;
-	enum tx2_uncore_type type;
+	unsigned int cpu;
+	int ret;
 
-	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
-	type = tx2_pmu->type;
+	tx2_pmu = pmu_to_tx2_pmu(dev_get_drvdata(dev));
+	ret = kstrtouint(buf, 0, &cpu);
+	if (ret)
+		return ret;
 
-	new = tx2_pmu_read_counter(event);
+	if (cpu >= nr_cpu_ids)
+		return -EINVAL;
 
-	/* DMC event data_transfers granularity is 16 Bytes, convert it to 64 */
-	if (type == PMU_TYPE_DMC &&
-			GET_EVENTID(event) == DMC_EVENT_DATA_TRANSFERS)
-		new = new/4;
+	cpus_read_lock();
+	mutex_lock(&tx2_pmu_cpu_lock);
+	if (cpu_online(cpu) && cpu_to_node(cpu) == tx2_pmu->node)
+		tx2_uncore_node_migrate(tx2_pmu->tx2_node, cpu);
+	else
+		ret = -EINVAL;
+	mutex_unlock(&tx2_pmu_cpu_lock);
+	cpus_read_unlock();
 
-	local64_add(new, &event->count);
+	return ret ? ret : count;
 }
+static DEVICE_ATTR_RW(cpumask);
 
-static enum tx2_uncore_type get_tx2_pmu_type(struct acpi_device *adev)
-{
-	int i = 0;
-	struct acpi_tx2_pmu_device {
-		__u8 id[ACPI_ID_LEN];
-		enum tx2_uncore_type type;
-	} devices[] = {
-		{"CAV901D", PMU_TYPE_L3C},
-		{"CAV901F", PMU_TYPE_DMC},
-		{"", PMU_TYPE_INVALID}
-	};
+static struct attribute *tx2_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL,
+};
 
-	while (devices[i].type != PMU_TYPE_INVALID) {
-		if (!strcmp(acpi_device_hid(adev), devices[i].id))
+static const struct attribute_group pmu_cpumask_attr_group = {
+	.attrs = tx2_pmu_cpumask_attrs,
+};
+
+static ssize_t aggr_cpumask_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct tx2_uncore_aggr *tx2_aggr;
+
+	tx2_aggr = pmu_to_tx2_aggr(dev_get_drvdata(dev));
+	return cpumap_print_to_pagebuf(true, buf,
+			cpumask_of(tx2_aggr->tx2_node->cpu));
+}
+
+static struct device_attribute dev_attr_aggr_cpumask =
+	__ATTR(cpumask, 0444, aggr_cpumask_show, NULL);
+
+static struct attribute *tx2_aggr_cpumask_attrs[] = {
+	&dev_attr_aggr_cpumask.attr,
+	NULL,
+};
+
+static const struct attribute_group aggr_cpumask_attr_group = {
+	.attrs = tx2_aggr_cpumask_attrs,
+};
+
+/*
+ * sysfs hrtimer attributes, bounds of the counter sampling interval in ms
+ */
+static ssize_t hrtimer_min_ms_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+
+	tx2_pmu = pmu_to_tx2_pmu(dev_get_drvdata(dev));
+	return sprintf(buf, "%llu\n",
+			div_u64(tx2_pmu->hrtimer_interval_min, NSEC_PER_MSEC));
+}
+
+static ssize_t hrtimer_min_ms_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+	unsigned int ms;
+	int ret;
+
+	tx2_pmu = pmu_to_tx2_pmu(dev_get_drvdata(dev));
+	ret = kstrtouint(buf, 0, &ms);
+	if (ret)
+		return ret;
+
+	if (!ms || (u64)ms * NSEC_PER_MSEC > tx2_pmu->hrtimer_interval_max)
+		return -EINVAL;
+
+	WRITE_ONCE(tx2_pmu->hrtimer_interval_min, (u64)ms * NSEC_PER_MSEC);
+	return count;
+}
+static DEVICE_ATTR_RW(hrtimer_min_ms);
+
+static ssize_t hrtimer_max_ms_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+
+	tx2_pmu = pmu_to_tx2_pmu(dev_get_drvdata(dev));
+	return sprintf(buf, "%llu\n",
+			div_u64(tx2_pmu->hrtimer_interval_max, NSEC_PER_MSEC));
+}
+
+static ssize_t hrtimer_max_ms_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+	unsigned int ms;
+	int ret;
+
+	tx2_pmu = pmu_to_tx2_pmu(dev_get_drvdata(dev));
+	ret = kstrtouint(buf, 0, &ms);
+	if (ret)
+		return ret;
+
+	if ((u64)ms * NSEC_PER_MSEC > TX2_PMU_HRTIMER_INTERVAL_LIMIT ||
+	    (u64)ms * NSEC_PER_MSEC < tx2_pmu->hrtimer_interval_min)
+		return -EINVAL;
+
+	WRITE_ONCE(tx2_pmu->hrtimer_interval_max, (u64)ms * NSEC_PER_MSEC);
+	return count;
+}
+static DEVICE_ATTR_RW(hrtimer_max_ms);
+
+static struct attribute *tx2_pmu_hrtimer_attrs[] = {
+	&dev_attr_hrtimer_min_ms.attr,
+	&dev_attr_hrtimer_max_ms.attr,
+	NULL,
+};
+
+static const struct attribute_group pmu_hrtimer_attr_group = {
+	.attrs = tx2_pmu_hrtimer_attrs,
+};
+
+/*
+ * Per PMU device attribute groups
+ */
+static const struct attribute_group *l3c_pmu_attr_groups[] = {
+	&l3c_pmu_format_attr_group,
+	&pmu_cpumask_attr_group,
+	&pmu_hrtimer_attr_group,
+	&l3c_pmu_events_attr_group,
+	NULL
+};
+
+static const struct attribute_group *dmc_pmu_attr_groups[] = {
+	&dmc_pmu_format_attr_group,
+	&pmu_cpumask_attr_group,
+	&pmu_hrtimer_attr_group,
+	&dmc_pmu_events_attr_group,
+	NULL
+};
+
+static const struct attribute_group *l3c_aggr_attr_groups[] = {
+	&l3c_pmu_format_attr_group,
+	&aggr_cpumask_attr_group,
+	&l3c_pmu_events_attr_group,
+	NULL
+};
+
+static const struct attribute_group *dmc_aggr_attr_groups[] = {
+	&dmc_pmu_format_attr_group,
+	&aggr_cpumask_attr_group,
+	&dmc_pmu_events_attr_group,
+	NULL
+};
+
+static const struct attribute_group *dmc_attrib_attr_groups[] = {
+	&dmc_attrib_format_attr_group,
+	&dmc_attrib_events_attr_group,
+	NULL
+};
+
+static inline u32 reg_readl(unsigned long addr)
+{
+	return readl((void __iomem *)addr);
+}
+
+static inline void reg_writel(u32 val, unsigned long addr)
+{
+	writel(val, (void __iomem *)addr);
+}
+
+/*
+ * Allocate a counter to count @event_id for @event: its pinned counter,
+ * else the counter it last counted @event_id on, which may still be
+ * programmed, else the first free counter.
+ */
+static int alloc_counter(struct tx2_uncore_pmu *tx2_pmu,
+		struct perf_event *event, u32 event_id)
+{
+	int counter;
+
+	if (GET_PIN(event)) {
+		counter = GET_COUNTER(event);
+		if (test_bit(counter, tx2_pmu->active_counters))
+			return -ENOSPC;
+		goto found;
+	}
+
+	for_each_clear_bit(counter, tx2_pmu->active_counters,
+			tx2_pmu->max_counters) {
+		if (tx2_pmu->cntr_last[counter] == event &&
+		    tx2_pmu->cntr_event[counter] == event_id)
+			goto found;
+	}
+
+	counter = find_first_zero_bit(tx2_pmu->active_counters,
+				tx2_pmu->max_counters);
+	if (counter == tx2_pmu->max_counters)
+		return -ENOSPC;
+
+found:
+	set_bit(counter, tx2_pmu->active_counters);
+	/*
+	 * Read failures are kept while the event is rescheduled on the
+	 * counter, e.g. at every multiplexing rotation.
+	 */
+	if (tx2_pmu->cntr_last[counter] != event ||
+	    tx2_pmu->cntr_event[counter] != event_id) {
+		clear_bit(counter, tx2_pmu->failed_counters);
+		tx2_pmu->smc_errors[counter] = 0;
+		tx2_pmu->smc_retry_ns[counter] = 0;
+	}
+	return counter;
+}
+
+static inline void free_counter(struct tx2_uncore_pmu *tx2_pmu, int counter)
+{
+	clear_bit(counter, tx2_pmu->active_counters);
+}
+
+static inline const struct tx2_uncore_metric *
+tx2_event_metric(struct perf_event *event)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+
+	if (!GET_METRIC(event))
+		return NULL;
+	return &tx2_pmu->metrics[GET_METRIC(event)];
+}
+
+/* Number of counters needed by an event */
+static inline int tx2_event_nr_counters(struct perf_event *event)
+{
+	const struct tx2_uncore_metric *metric = tx2_event_metric(event);
+
+	return metric ? metric->nr_events : 1;
+}
+
+/* Channels/tiles counted by an event */
+static inline void tx2_event_chans(struct perf_event *event,
+		int *first, int *last)
+{
+	if (GET_SCOPE(event) == EVENT_SCOPE_ALL) {
+		*first = 0;
+		*last = pmu_to_tx2_pmu(event->pmu)->nr_chans - 1;
+	} else {
+		*first = *last = GET_CHANNELID(event);
+	}
+}
+
+static void tx2_stat_add(struct tx2_uncore_stat *stat, u64 ns, bool failed)
+{
+	stat->calls++;
+	stat->failures += failed;
+	stat->total_ns += ns;
+	stat->max_ns = max(stat->max_ns, ns);
+	stat->hist[min_t(int, fls64(ns >> 8), TX2_STAT_BUCKETS - 1)]++;
+}
+
+/* Vendor SMC call for the node of the PMU, accounted in its stats */
+static void tx2_pmu_smc(struct tx2_uncore_pmu *tx2_pmu, int stat,
+		unsigned long fn, unsigned long a3, unsigned long a4,
+		struct arm_smccc_res *res)
+{
+	u64 start = ktime_get_ns();
+
+	arm_smccc_smc(THUNDERX2_SMC_CALL_ID, fn, tx2_pmu->node, a3, a4,
+			0, 0, 0, res);
+	tx2_stat_add(&tx2_pmu->smc_stats[stat], ktime_get_ns() - start,
+			res->a0);
+}
+
+/*
+ *
+ *  SMC call arguments,
+ *	x0 = THUNDERX2_SMC_CALL_ID	(Vendor SMC call Id)
+ *	x1 = SELECT_CHANNEL
+ *	x2 = Node id
+ *	x3 = channel/tile
+ *	x4 = PMU type (0: L3C, 1: DMC)
+ *
+ *	return a0 = 0 success
+ *
+ *  Maps the registers of the channel at the register window of a device
+ *  its channels are muxed behind, the counters of all channels count
+ *  independently. Called with the PMU lock held.
+ */
+static int tx2_pmu_select_chan(struct tx2_uncore_pmu *tx2_pmu, int chan)
+{
+	struct tx2_user_state *state = tx2_pmu->user_state;
+	struct arm_smccc_res res;
+
+	if (!tx2_pmu->chan_mux || tx2_pmu->cur_chan == chan)
+		return 0;
+
+	/* user space reads channel 0, seq is odd while it is not selected */
+	if (state && !tx2_pmu->cur_chan) {
+		WRITE_ONCE(state->seq, state->seq + 1);
+		smp_wmb();
+	}
+
+	tx2_pmu_smc(tx2_pmu, TX2_SMC_SELECT, SELECT_CHANNEL, chan,
+			tx2_pmu->type, &res);
+	tx2_pmu->cur_chan = res.a0 ? -1 : chan;
+
+	if (state && !tx2_pmu->cur_chan) {
+		smp_wmb();
+		WRITE_ONCE(state->seq, state->seq + 1);
+	}
+
+	if (res.a0) {
+		dev_err_ratelimited(tx2_pmu->dev,
+			"SMC to select channel %d failed for PMU UNCORE[%s]\n",
+				chan, tx2_pmu->name);
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Leave channel 0 selected for user space, see tx2_uncore_user_update */
+static inline void tx2_pmu_release_chan(struct tx2_uncore_pmu *tx2_pmu)
+{
+	if (tx2_pmu->user_state)
+		tx2_pmu_select_chan(tx2_pmu, 0);
+}
+
+/* Channels @first to @last of the PMU, skipping those failing to select */
+#define for_each_chan(chan, tx2_pmu, first, last)			\
+	for ((chan) = (first); (chan) <= (last); (chan)++)		\
+		if (!tx2_pmu_select_chan(tx2_pmu, chan))
+
+static inline unsigned long chan_reg(struct tx2_uncore_pmu *tx2_pmu,
+		int chan, unsigned long offset)
+{
+	return (unsigned long)tx2_pmu->chan_base[chan] + offset;
+}
+
+static void init_cntr_base_l3c(struct tx2_uncore_pmu *tx2_pmu)
+{
+	int idx;
+
+	/* counter ctrl/data reg offset at 8, relative to the tile base */
+	for (idx = 0; idx < tx2_pmu->max_counters; idx++) {
+		tx2_pmu->cntr_ctl[idx] = L3C_COUNTER_CTL + (8 * idx);
+		tx2_pmu->cntr_data[idx] = L3C_COUNTER_DATA + (8 * idx);
+	}
+}
+
+static void init_cntr_base_dmc(struct tx2_uncore_pmu *tx2_pmu)
+{
+	int idx;
+
+	/* counter data reg offset at 0xc, relative to the channel base */
+	for (idx = 0; idx < tx2_pmu->max_counters; idx++) {
+		tx2_pmu->cntr_ctl[idx] = DMC_COUNTER_CTL;
+		tx2_pmu->cntr_data[idx] = DMC_COUNTER_DATA + (0xc * idx);
+	}
+}
+
+static void uncore_start_event_l3c(struct perf_event *event, int idx,
+		u32 event_id)
+{
+	u32 val;
+	int chan, first, last;
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+
+	/* event id encoded in bits [07:03] */
+	val = event_id << 3;
+	tx2_event_chans(event, &first, &last);
+	for_each_chan(chan, tx2_pmu, first, last) {
+		reg_writel(val, chan_reg(tx2_pmu, chan, tx2_pmu->cntr_ctl[idx]));
+		local64_set(&tx2_pmu->chan_prev_count[idx][chan], 0);
+		reg_writel(0, chan_reg(tx2_pmu, chan, tx2_pmu->cntr_data[idx]));
+	}
+	tx2_pmu_release_chan(tx2_pmu);
+}
+
+/*
+ * Start the counters of @mask with their @event_ids, or stop them for
+ * event id 0, keeping the counts.
+ */
+static u64 uncore_startstop_counters_l3c(struct tx2_uncore_pmu *tx2_pmu,
+		unsigned long mask, const u32 *event_ids)
+{
+	int idx, chan, first, last;
+
+	for_each_set_bit(idx, &mask, tx2_pmu->max_counters) {
+		tx2_event_chans(tx2_pmu->cntr_last[idx], &first, &last);
+		for_each_chan(chan, tx2_pmu, first, last)
+			reg_writel(event_ids[idx] << 3,
+				chan_reg(tx2_pmu, chan, tx2_pmu->cntr_ctl[idx]));
+	}
+	tx2_pmu_release_chan(tx2_pmu);
+	return 0;
+}
+
+static void uncore_stop_event_l3c(struct perf_event *event, int idx)
+{
+	int chan, first, last;
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+
+	tx2_event_chans(event, &first, &last);
+	for_each_chan(chan, tx2_pmu, first, last)
+		reg_writel(0, chan_reg(tx2_pmu, chan, tx2_pmu->cntr_ctl[idx]));
+	tx2_pmu_release_chan(tx2_pmu);
+}
+
+static void uncore_start_event_dmc(struct perf_event *event, int idx,
+		u32 event_id)
+{
+	u32 val;
+	int chan, first, last;
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	unsigned long ctl = tx2_pmu->cntr_ctl[idx];
+
+	/* enable and start counters.
+	 * 8 bits for each counter, bits[05:01] of a counter to set event type.
+	 */
+	tx2_event_chans(event, &first, &last);
+	for_each_chan(chan, tx2_pmu, first, last) {
+		val = reg_readl(chan_reg(tx2_pmu, chan, ctl));
+		val &= ~DMC_EVENT_CFG(idx, 0x1f);
+		val |= DMC_EVENT_CFG(idx, event_id);
+		reg_writel(val, chan_reg(tx2_pmu, chan, ctl));
+		local64_set(&tx2_pmu->chan_prev_count[idx][chan], 0);
+		reg_writel(0, chan_reg(tx2_pmu, chan, tx2_pmu->cntr_data[idx]));
+	}
+	tx2_pmu_release_chan(tx2_pmu);
+}
+
+/* All counters of a channel are controlled by one register */
+static u64 uncore_startstop_counters_dmc(struct tx2_uncore_pmu *tx2_pmu,
+		unsigned long mask, const u32 *event_ids)
+{
+	int idx, chan, first, last;
+	u32 val, cfg, clr;
+
+	for (chan = 0; chan < tx2_pmu->nr_chans; chan++) {
+		cfg = clr = 0;
+		for_each_set_bit(idx, &mask, tx2_pmu->max_counters) {
+			tx2_event_chans(tx2_pmu->cntr_last[idx], &first, &last);
+			if (chan < first || chan > last)
+				continue;
+			clr |= DMC_EVENT_CFG(idx, 0x1f);
+			cfg |= DMC_EVENT_CFG(idx, event_ids[idx]);
+		}
+		if (!clr || tx2_pmu_select_chan(tx2_pmu, chan))
+			continue;
+
+		val = reg_readl(chan_reg(tx2_pmu, chan, DMC_COUNTER_CTL));
+		val = (val & ~clr) | cfg;
+		reg_writel(val, chan_reg(tx2_pmu, chan, DMC_COUNTER_CTL));
+	}
+	tx2_pmu_release_chan(tx2_pmu);
+	return 0;
+}
+
+static void uncore_stop_event_dmc(struct perf_event *event, int idx)
+{
+	u32 val;
+	int chan, first, last;
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	unsigned long ctl = tx2_pmu->cntr_ctl[idx];
+
+	/* clear event type(bits[05:01]) to stop counter */
+	tx2_event_chans(event, &first, &last);
+	for_each_chan(chan, tx2_pmu, first, last) {
+		val = reg_readl(chan_reg(tx2_pmu, chan, ctl));
+		val &= ~DMC_EVENT_CFG(idx, 0x1f);
+		reg_writel(val, chan_reg(tx2_pmu, chan, ctl));
+	}
+	tx2_pmu_release_chan(tx2_pmu);
+}
+
+static void uncore_reset_counter_mmio(struct perf_event *event, int idx)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	int chan, first, last;
+
+	tx2_event_chans(event, &first, &last);
+	for_each_chan(chan, tx2_pmu, first, last) {
+		local64_set(&tx2_pmu->chan_prev_count[idx][chan], 0);
+		reg_writel(0, chan_reg(tx2_pmu, chan, tx2_pmu->cntr_data[idx]));
+	}
+	tx2_pmu_release_chan(tx2_pmu);
+}
+
+/*
+ * MMIO counters are free running, return the count since the previous
+ * read. The timer and a reader may race, only the one succeeding to
+ * advance prev_count accounts the delta.
+ */
+static u64 uncore_read_chan_mmio(local64_t *prev_count, unsigned long addr)
+{
+	u64 prev, new;
+
+	do {
+		prev = local64_read(prev_count);
+		new = reg_readl(addr);
+	} while (local64_cmpxchg(prev_count, prev, new) != prev);
+
+	/* handles rollover of 32 bit counter */
+	return (new - prev) & TX2_PMU_COUNTER_MASK;
+}
+
+static u64 uncore_read_counter_mmio(struct perf_event *event, int idx)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	int chan, first, last;
+	u64 delta = 0;
+
+	tx2_event_chans(event, &first, &last);
+	for_each_chan(chan, tx2_pmu, first, last)
+		delta += uncore_read_chan_mmio(
+				&tx2_pmu->chan_prev_count[idx][chan],
+				chan_reg(tx2_pmu, chan, tx2_pmu->cntr_data[idx]));
+	tx2_pmu_release_chan(tx2_pmu);
+	return delta;
+}
+
+/*
+ *
+ *  SMC call arguments,
+ *	x0 = THUNDERX2_SMC_CALL_ID	(Vendor SMC call Id)
+ *	x1 = L3C_STARTSTOP_COUNTER/DMC_STARTSTOP_COUNTER
+ *	x2 = Node id
+ *	x3 = counter id
+ *	x4 = stop(0)/event_id
+ *
+ *	return a0 = 0 success
+ */
+static u64 tx2_pmu_startstop_counter(struct perf_event *event, int counter_id,
+		u32 event_id)
+{
+	struct arm_smccc_res res;
+
+	struct tx2_uncore_pmu *tx2_pmu;
+	enum tx2_uncore_type type;
+
+	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	type = tx2_pmu->type;
+
+	tx2_pmu_smc(tx2_pmu, TX2_SMC_STARTSTOP,
+			type ?  DMC_STARTSTOP_COUNTER : L3C_STARTSTOP_COUNTER,
+			counter_id, event_id, &res);
+	if (res.a0) {
+		dev_err_ratelimited(tx2_pmu->dev,
+			"SMC to %s counter %d failed for PMU UNCORE[%s]\n",
+				event_id ? "start" : "stop", counter_id,
+				tx2_pmu->name);
+	}
+	return res.a0;
+}
+
+/*
+ * Time until counter @idx may advance by 3/4 of its range, at the
+ * maximum rate of its event. The only rates known to bound the events are
+ * the clocks, which makes this about 1s for the L3C, shorter than the
+ * default interval, see thunderx2-pmu.txt.
+ */
+static u64 tx2_uncore_wrap_ns(struct tx2_uncore_pmu *tx2_pmu, int idx)
+{
+	u64 clocks = 3ULL << 30;
+
+	/* a 64 byte DMC transaction takes 4 clocks */
+	if (tx2_pmu->type == PMU_TYPE_DMC &&
+	    (tx2_pmu->cntr_event[idx] == DMC_EVENT_READ_TXNS ||
+	     tx2_pmu->cntr_event[idx] == DMC_EVENT_WRITE_TXNS))
+		clocks *= 4;
+
+	return div64_u64(clocks * NSEC_PER_SEC, tx2_pmu->clock_hz);
+}
+
+/*
+ * Back off from a counter the firmware fails to read, skipping its reads
+ * for 10ms << n after n consecutive failures. As the firmware clears the
+ * counter on read, the skipped counts are returned by the next read that
+ * succeeds, unless the 32 bit counter wrapped meanwhile: the counter is
+ * retried within half the time it may take to wrap since it was last
+ * read. The counter is given up on, and counts no more until another
+ * event takes it, after TX2_SMC_MAX_ERRORS failures. Called with the
+ * lock held.
+ */
+static void tx2_pmu_counter_failed(struct tx2_uncore_pmu *tx2_pmu, int idx,
+		u64 now)
+{
+	u8 errors = ++tx2_pmu->smc_errors[idx];
+
+	if (errors < TX2_SMC_MAX_ERRORS) {
+		tx2_pmu->smc_retry_ns[idx] = min(
+			now + (TX2_PMU_HRTIMER_INTERVAL_MIN << errors),
+			tx2_pmu->smc_read_ns[idx] +
+				tx2_uncore_wrap_ns(tx2_pmu, idx) / 2);
+		dev_err_ratelimited(tx2_pmu->dev,
+			"SMC to read counter %d failed for PMU UNCORE[%s]\n",
+				idx, tx2_pmu->name);
+		return;
+	}
+
+	set_bit(idx, tx2_pmu->failed_counters);
+	dev_err(tx2_pmu->dev,
+		"PMU UNCORE[%s]: counter %d disabled after %d SMC failures\n",
+			tx2_pmu->name, idx, errors);
+}
+
+static void uncore_start_event_smc(struct perf_event *event, int idx,
+		u32 event_id)
+{
+	tx2_pmu_startstop_counter(event, idx, event_id);
+}
+
+static void uncore_stop_event_smc(struct perf_event *event, int idx)
+{
+	tx2_pmu_startstop_counter(event, idx, 0);
+}
+
+/*
+ *
+ *  SMC call arguments,
+ *	x0 = THUNDERX2_SMC_CALL_ID	(Vendor SMC call Id)
+ *	x1 = THUNDERX2_SMC_READ_COUNTER
+ *	x2 = Node id
+ *	x3 = counter id
+ *
+ *	return a0 = 0 success
+ *	return a1 = counter value
+ *
+ *  The firmware clears the counter on read, the value returned is the
+ *  count since the previous read.
+ */
+static u64 tx2_pmu_read_counter(struct perf_event *event, int counter_id)
+{
+	struct arm_smccc_res res;
+
+	struct tx2_uncore_pmu *tx2_pmu;
+	enum tx2_uncore_type type;
+	u64 now;
+
+	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	type = tx2_pmu->type;
+
+	if (test_bit(counter_id, tx2_pmu->failed_counters))
+		return 0;
+	now = ktime_get_ns();
+	if (now < tx2_pmu->smc_retry_ns[counter_id])
+		return 0;
+
+	tx2_pmu_smc(tx2_pmu, TX2_SMC_READ,
+			type ? DMC_READ_COUNTER : L3C_READ_COUNTER,
+			counter_id, 0, &res);
+	if (res.a0) {
+		tx2_pmu_counter_failed(tx2_pmu, counter_id, now);
+		return 0;
+	}
+
+	if (tx2_pmu->smc_errors[counter_id] &&
+	    now - tx2_pmu->smc_read_ns[counter_id] >
+			tx2_uncore_wrap_ns(tx2_pmu, counter_id))
+		dev_warn_ratelimited(tx2_pmu->dev,
+			"PMU UNCORE[%s]: counter %d not read for %llu ms, counts may be lost\n",
+				tx2_pmu->name, counter_id,
+				div_u64(now - tx2_pmu->smc_read_ns[counter_id],
+					NSEC_PER_MSEC));
+	tx2_pmu->smc_errors[counter_id] = 0;
+	tx2_pmu->smc_retry_ns[counter_id] = 0;
+	tx2_pmu->smc_read_ns[counter_id] = now;
+	return res.a1 & TX2_PMU_COUNTER_MASK;
+}
+
+/*
+ *
+ *  SMC call arguments,
+ *	x0 = THUNDERX2_SMC_CALL_ID	(Vendor SMC call Id)
+ *	x1 = L3C_READ_ALL_COUNTERS/DMC_READ_ALL_COUNTERS
+ *	x2 = Node id
+ *	x3 = bitmap of counters to read
+ *
+ *	return a0 = 0 success
+ *	return a1 = counter 1 value[63:32], counter 0 value[31:0]
+ *	return a2 = counter 3 value[63:32], counter 2 value[31:0]
+ *
+ *  Older firmware does not implement this call and fails it.
+ */
+static u64 tx2_pmu_read_counters(struct tx2_uncore_pmu *tx2_pmu,
+		unsigned long mask, u32 *counters)
+{
+	struct arm_smccc_res res;
+
+	tx2_pmu_smc(tx2_pmu, TX2_SMC_READ_ALL, tx2_pmu->type ?
+			DMC_READ_ALL_COUNTERS : L3C_READ_ALL_COUNTERS,
+			mask, 0, &res);
+	if (res.a0)
+		return res.a0;
+
+	counters[0] = lower_32_bits(res.a1);
+	counters[1] = upper_32_bits(res.a1);
+	counters[2] = lower_32_bits(res.a2);
+	counters[3] = upper_32_bits(res.a2);
+	return 0;
+}
+
+/*
+ * Batched read is used only if the firmware advertises it,
+ * i.e. succeeds the call with an empty bitmap.
+ */
+static bool tx2_pmu_probe_batch_read(struct tx2_uncore_pmu *tx2_pmu)
+{
+	u32 counters[TX2_PMU_MAX_COUNTERS];
+
+	return !tx2_pmu_read_counters(tx2_pmu, 0, counters);
+}
+
+/*
+ *
+ *  SMC call arguments,
+ *	x0 = THUNDERX2_SMC_CALL_ID	(Vendor SMC call Id)
+ *	x1 = L3C_STARTSTOP_COUNTERS/DMC_STARTSTOP_COUNTERS
+ *	x2 = Node id
+ *	x3 = bitmap of counters to start/stop
+ *	x4 = event id of counter n in bits [8n+7:8n], stop(0)
+ *
+ *	return a0 = 0 success
+ *
+ *  The counters keep their value, which is cleared by the next read.
+ *  Older firmware does not implement this call and fails it.
+ */
+static u64 tx2_pmu_startstop_counters(struct tx2_uncore_pmu *tx2_pmu,
+		unsigned long mask, const u32 *event_ids)
+{
+	struct arm_smccc_res res;
+	u64 ids = 0;
+	int idx;
+
+	for_each_set_bit(idx, &mask, tx2_pmu->max_counters)
+		ids |= (u64)event_ids[idx] << (idx * 8);
+
+	tx2_pmu_smc(tx2_pmu, TX2_SMC_STARTSTOP_ALL, tx2_pmu->type ?
+			DMC_STARTSTOP_COUNTERS : L3C_STARTSTOP_COUNTERS,
+			mask, ids, &res);
+	if (res.a0 && mask) {
+		dev_err_ratelimited(tx2_pmu->dev,
+			"SMC to start/stop counters failed for PMU UNCORE[%s]\n",
+				tx2_pmu->name);
+	}
+	return res.a0;
+}
+
+/*
+ * Emulated counters, advancing by emulate_rate per second while started,
+ * behave as free running 32 bit MMIO counters: they wrap if not read
+ * often enough.
+ */
+static void tx2_emul_advance(struct tx2_uncore_pmu *tx2_pmu, int idx)
+{
+	u64 now = ktime_get_ns();
+	u64 ns = now - tx2_pmu->emul_time[idx];
+	u32 rem;
+
+	if (test_bit(idx, &tx2_pmu->emul_running)) {
+		tx2_pmu->emul_count[idx] +=
+			div_u64_rem(ns, NSEC_PER_SEC, &rem) * emulate_rate +
+			div_u64((u64)rem * emulate_rate, NSEC_PER_SEC);
+	}
+	tx2_pmu->emul_time[idx] = now;
+}
+
+static void tx2_emul_startstop(struct tx2_uncore_pmu *tx2_pmu, int idx,
+		u32 event_id)
+{
+	tx2_emul_advance(tx2_pmu, idx);
+	if (event_id)
+		__set_bit(idx, &tx2_pmu->emul_running);
+	else
+		__clear_bit(idx, &tx2_pmu->emul_running);
+}
+
+
+static u64 uncore_read_counter_emul(struct perf_event *event, int idx)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	local64_t *prev_count = &tx2_pmu->chan_prev_count[idx][0];
+	u64 prev, new;
+
+	tx2_emul_advance(tx2_pmu, idx);
+	new = tx2_pmu->emul_count[idx] & TX2_PMU_COUNTER_MASK;
+	prev = local64_read(prev_count);
+	local64_set(prev_count, new);
+
+	/* handles rollover of 32 bit counter */
+	return (new - prev) & TX2_PMU_COUNTER_MASK;
+}
+
+static void uncore_reset_counter_emul(struct perf_event *event, int idx)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+
+	local64_set(&tx2_pmu->chan_prev_count[idx][0], 0);
+	tx2_pmu->emul_count[idx] = 0;
+}
+
+static void uncore_start_event_emul(struct perf_event *event, int idx,
+		u32 event_id)
+{
+	uncore_reset_counter_emul(event, idx);
+	tx2_emul_startstop(pmu_to_tx2_pmu(event->pmu), idx, event_id);
+}
+
+static void uncore_stop_event_emul(struct perf_event *event, int idx)
+{
+	tx2_emul_startstop(pmu_to_tx2_pmu(event->pmu), idx, 0);
+}
+
+static u64 uncore_startstop_counters_emul(struct tx2_uncore_pmu *tx2_pmu,
+		unsigned long mask, const u32 *event_ids)
+{
+	int idx;
+
+	for_each_set_bit(idx, &mask, tx2_pmu->max_counters)
+		tx2_emul_startstop(tx2_pmu, idx, event_ids[idx]);
+	return 0;
+}
+
+static const struct tx2_uncore_ops tx2_smc_ops = {
+	.start_event		= uncore_start_event_smc,
+	.stop_event		= uncore_stop_event_smc,
+	.read_counter		= tx2_pmu_read_counter,
+};
+
+/* Firmware implementing the start/stop of several counters at once */
+static const struct tx2_uncore_ops tx2_smc_batch_ops = {
+	.start_event		= uncore_start_event_smc,
+	.stop_event		= uncore_stop_event_smc,
+	.read_counter		= tx2_pmu_read_counter,
+	.startstop_counters	= tx2_pmu_startstop_counters,
+};
+
+static const struct tx2_uncore_ops tx2_l3c_mmio_ops = {
+	.start_event		= uncore_start_event_l3c,
+	.stop_event		= uncore_stop_event_l3c,
+	.read_counter		= uncore_read_counter_mmio,
+	.reset_counter		= uncore_reset_counter_mmio,
+	.startstop_counters	= uncore_startstop_counters_l3c,
+};
+
+static const struct tx2_uncore_ops tx2_dmc_mmio_ops = {
+	.start_event		= uncore_start_event_dmc,
+	.stop_event		= uncore_stop_event_dmc,
+	.read_counter		= uncore_read_counter_mmio,
+	.reset_counter		= uncore_reset_counter_mmio,
+	.startstop_counters	= uncore_startstop_counters_dmc,
+};
+
+static const struct tx2_uncore_ops tx2_emul_ops = {
+	.start_event		= uncore_start_event_emul,
+	.stop_event		= uncore_stop_event_emul,
+	.read_counter		= uncore_read_counter_emul,
+	.reset_counter		= uncore_reset_counter_emul,
+	.startstop_counters	= uncore_startstop_counters_emul,
+};
+
+/* @num / @den in TX2_PMU_RATIO_SCALE units, for any @num */
+static u64 tx2_metric_ratio(u64 num, u64 den)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	return mul_u64_u64_div_u64(num, TX2_PMU_RATIO_SCALE, den);
+#else
+	/* mul_u64_u64_div_u64() is exported from 5.9, drop low bits */
+	while (num > div64_u64(U64_MAX, TX2_PMU_RATIO_SCALE)) {
+		num >>= 1;
+		den >>= 1;
+	}
+	return den ? div64_u64(num * TX2_PMU_RATIO_SCALE, den) : 0;
+#endif
+}
+
+/* Fold the count of one of the events of a metric into the event count */
+static void tx2_metric_update(struct perf_event *event,
+		const struct tx2_uncore_metric *metric, int metric_idx, u64 new)
+{
+	struct tx2_metric_state *state = event->pmu_private;
+	u64 num, den;
+
+	if (metric->type == METRIC_TYPE_SUM) {
+		local64_add(new * metric->mult, &event->count);
+		return;
+	}
+
+	num = local64_read(&state->count[0]);
+	den = local64_read(&state->count[1]);
+	if (metric_idx)
+		den = local64_add_return(new, &state->count[1]);
+	else
+		num = local64_add_return(new, &state->count[0]);
+	if (den)
+		local64_set(&event->count,
+			tx2_metric_ratio(num, den));
+}
+
+/*
+ * Publish the state of counter @idx, of @event or free, to user space.
+ * Only the count of an event of channel 0 follows from its register, the
+ * counters of other events are published as free.
+ */
+static void tx2_uncore_user_update(struct tx2_uncore_pmu *tx2_pmu, int idx,
+		struct perf_event *event)
+{
+	struct tx2_user_state *state = tx2_pmu->user_state;
+	struct tx2_user_counter *cntr;
+
+	if (!state)
+		return;
+
+	if (event && (GET_SCOPE(event) == EVENT_SCOPE_ALL ||
+		      GET_CHANNELID(event) || tx2_event_metric(event)))
+		event = NULL;
+
+	cntr = &state->counters[idx];
+	WRITE_ONCE(state->seq, state->seq + 1);
+	smp_wmb();
+	cntr->active = !!event;
+	if (event) {
+		cntr->config = event->attr.config;
+		cntr->raw = local64_read(&tx2_pmu->chan_prev_count[idx][0]);
+		cntr->count = local64_read(&event->count);
+	}
+	smp_wmb();
+	WRITE_ONCE(state->seq, state->seq + 1);
+}
+
+/*
+ * Account @new, the count since the previous read of counter @idx.
+ * Backends hand out every count once, so concurrent updates from the
+ * timer and readers do not double count. Called with tx2_pmu->lock held.
+ */
+static void __tx2_uncore_event_update(struct perf_event *event, int idx,
+		u64 new)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+	const struct tx2_uncore_metric *metric;
+	enum tx2_uncore_type type;
+	u64 now, elapsed;
+
+	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	type = tx2_pmu->type;
+
+	/* raw count, to track the counter rate between samples */
+	local64_add(new, &tx2_pmu->sample_count[idx]);
+
+	now = ktime_get_ns();
+	elapsed = now - tx2_pmu->last_sync[idx];
+	tx2_pmu->last_sync[idx] = now;
+
+	/* measure the DMC clock, on a single channel */
+	if (type == PMU_TYPE_DMC &&
+	    tx2_pmu->cntr_event[idx] == DMC_EVENT_COUNT_CYCLES &&
+	    GET_SCOPE(event) != EVENT_SCOPE_ALL &&
+	    elapsed >= TX2_PMU_HRTIMER_INTERVAL_MIN && new)
+		tx2_pmu->clock_hz = min_t(u64, TX2_PMU_DMC_CLOCK_MAX_HZ,
+				div64_u64(new * NSEC_PER_SEC, elapsed));
+
+	/* L3C and DMC has 16 and 8 interleave channels respectively.
+	 * Unless asked for a channel or all channels, the MMIO sampled value
+	 * is for one channel and multiplied with prorate_factor to get the
+	 * count for a device.
+	 */
+	if (GET_SCOPE(event) == EVENT_SCOPE_PRORATE)
+		new *= tx2_pmu->prorate_factor;
+
+	metric = tx2_event_metric(event);
+	if (metric)
+		tx2_metric_update(event, metric,
+				tx2_pmu->cntr_metric_idx[idx], new);
+	else
+		local64_add(new, &event->count);
+
+	/* self monitoring reads the count as of the last read */
+	tx2_event_update_userpage(event);
+	tx2_uncore_user_update(tx2_pmu, idx, event);
+}
+
+static void tx2_uncore_event_update(struct perf_event *event)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	unsigned long flags;
+	int idx;
+
+	raw_spin_lock_irqsave(&tx2_pmu->lock, flags);
+	for_each_event_counter(idx, tx2_pmu, event)
+		__tx2_uncore_event_update(event, idx,
+				tx2_pmu->ops->read_counter(event, idx));
+	raw_spin_unlock_irqrestore(&tx2_pmu->lock, flags);
+}
+
+static enum tx2_uncore_type get_tx2_pmu_type(struct acpi_device *adev)
+{
+	int i = 0;
+	struct acpi_tx2_pmu_device {
+		__u8 id[ACPI_ID_LEN];
+		enum tx2_uncore_type type;
+	} devices[] = {
+		{"CAV901D", PMU_TYPE_L3C},
+		{"CAV901F", PMU_TYPE_DMC},
+		{"", PMU_TYPE_INVALID}
+	};
+
+	while (devices[i].type != PMU_TYPE_INVALID) {
+		if (!strcmp(acpi_device_hid(adev), devices[i].id))
 			break;
 		i++;
 	}
 
-	return devices[i].type;
+	return devices[i].type;
+}
+
+static bool tx2_uncore_validate_event(struct pmu *pmu,
+				  struct perf_event *event, int *counters,
+				  unsigned long *pinned)
+{
+	if (is_software_event(event))
+		return true;
+	/* Reject groups spanning multiple HW PMUs. */
+	if (event->pmu != pmu)
+		return false;
+
+	/* Reject events pinned to the same counter */
+	if (GET_PIN(event) && __test_and_set_bit(GET_COUNTER(event), pinned))
+		return false;
+
+	*counters = *counters + tx2_event_nr_counters(event);
+	return true;
+}
+
+/*
+ * Make sure the group of events can be scheduled at once
+ * on the PMU.
+ */
+static bool tx2_uncore_validate_event_group(struct perf_event *event)
+{
+	struct perf_event *sibling, *leader = event->group_leader;
+	unsigned long pinned = 0;
+	int counters = 0;
+
+	if (event->group_leader == event)
+		return tx2_event_nr_counters(event) <= TX2_PMU_MAX_COUNTERS;
+
+	if (!tx2_uncore_validate_event(event->pmu, leader, &counters,
+			&pinned))
+		return false;
+
+	for_each_sibling_event(sibling, leader) {
+		if (!tx2_uncore_validate_event(event->pmu, sibling, &counters,
+				&pinned))
+			return false;
+	}
+
+	if (!tx2_uncore_validate_event(event->pmu, event, &counters, &pinned))
+		return false;
+
+	/*
+	 * If the group requires more counters than the HW has,
+	 * it cannot ever be scheduled.
+	 */
+	return counters <= TX2_PMU_MAX_COUNTERS;
+}
+
+/*
+ * Channel/tile selection needs MMIO access to the channel registers, see
+ * tx2_uncore_init_chans, the firmware only reports the count of channel 0.
+ */
+static bool tx2_uncore_validate_event_scope(struct perf_event *event)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+
+	if (tx2_pmu->ops->read_counter != uncore_read_counter_mmio)
+		return GET_SCOPE(event) == EVENT_SCOPE_PRORATE &&
+			!GET_CHANNELID(event);
+
+	switch (GET_SCOPE(event)) {
+	case EVENT_SCOPE_PRORATE:
+	case EVENT_SCOPE_CHANNEL:
+		return GET_CHANNELID(event) < tx2_pmu->nr_chans;
+	case EVENT_SCOPE_ALL:
+		return !GET_CHANNELID(event) &&
+			tx2_pmu->nr_chans == tx2_pmu->max_chans;
+	}
+	return false;
+}
+
+static void tx2_uncore_event_destroy(struct perf_event *event)
+{
+	kfree(event->pmu_private);
+}
+
+static void tx2_uncore_hist_destroy(struct perf_event *event)
+{
+	struct tx2_hist_state *hist = event->pmu_private;
+
+	mutex_lock(&tx2_hist_lock);
+	list_del(&hist->entry);
+	mutex_unlock(&tx2_hist_lock);
+	kfree(hist);
+}
+
+static int tx2_uncore_hist_init(struct perf_event *event)
+{
+	struct tx2_hist_state *hist;
+
+	hist = kzalloc(sizeof(*hist), GFP_KERNEL);
+	if (!hist)
+		return -ENOMEM;
+
+	hist->event = event;
+	event->pmu_private = hist;
+	event->destroy = tx2_uncore_hist_destroy;
+
+	mutex_lock(&tx2_hist_lock);
+	list_add_tail(&hist->entry, &tx2_hist_events);
+	mutex_unlock(&tx2_hist_lock);
+	return 0;
+}
+
+static int tx2_uncore_event_init(struct perf_event *event)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	struct tx2_uncore_pmu *tx2_pmu;
+
+	/* Test the event attr type check for PMU enumeration */
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	/*
+	 * SOC PMU counters are shared across all cores.
+	 * Therefore, it does not support per-process mode.
+	 * Sampling events take sample_period as a rate threshold, see
+	 * tx2_uncore_event_threshold, lazy sampling does not read the
+	 * counters every interval.
+	 */
+	if (event->attach_state & PERF_ATTACH_TASK)
+		return -EINVAL;
+	if (is_sampling_event(event) && (event->attr.freq || lazy_sampling))
+		return -EINVAL;
+
+	/* We have no filtering of any kind */
+	if (event->attr.exclude_user	||
+	    event->attr.exclude_kernel	||
+	    event->attr.exclude_hv	||
+	    event->attr.exclude_idle	||
+	    event->attr.exclude_host	||
+	    event->attr.exclude_guest)
+		return -EINVAL;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	if (tx2_pmu->tx2_node->cpu >= nr_cpu_ids)
+		return -EINVAL;
+	event->cpu = tx2_pmu->tx2_node->cpu;
+
+#ifdef PERF_EV_CAP_READ_ACTIVE_PKG
+	/* Counters are read under the PMU lock, on any CPU of the socket */
+	event->event_caps |= PERF_EV_CAP_READ_ACTIVE_PKG;
+#endif
+
+	if (event->attr.config & ~TX2_PMU_CONFIG_MASK)
+		return -EINVAL;
+
+	/* store event id */
+	hwc->config = event->attr.config;
+	if (GET_EVENTID(event) >= tx2_pmu->max_events)
+		return -EINVAL;
+
+	/* a metric selects its own events */
+	if (GET_METRIC(event) && (GET_EVENTID(event) ||
+			GET_METRIC(event) >= tx2_pmu->max_metrics))
+		return -EINVAL;
+
+	/* a counter is only given to pin a single counter event */
+	if (GET_PIN(event) ? GET_METRIC(event) : GET_COUNTER(event))
+		return -EINVAL;
+
+	/*
+	 * perf scales the count of a multiplexed event by the time it was
+	 * counting, which is wrong for a ratio: ratio metrics must be
+	 * pinned, as the events of the aggregate PMUs are.
+	 */
+	if (GET_METRIC(event) &&
+	    tx2_event_metric(event)->type == METRIC_TYPE_RATIO &&
+	    !event->group_leader->attr.pinned)
+		return -EINVAL;
+
+	if (!tx2_uncore_validate_event_scope(event))
+		return -EOPNOTSUPP;
+
+	/* Validate the group */
+	if (!tx2_uncore_validate_event_group(event))
+		return -EINVAL;
+
+	/*
+	 * The histogram is built at every sample, not taken by lazy
+	 * sampling, and is of counts, not of ratios.
+	 */
+	if (GET_HIST(event)) {
+		if (lazy_sampling || (GET_METRIC(event) &&
+		    tx2_event_metric(event)->type == METRIC_TYPE_RATIO))
+			return -EINVAL;
+		return tx2_uncore_hist_init(event);
+	}
+
+	if (GET_METRIC(event) &&
+	    tx2_event_metric(event)->type == METRIC_TYPE_RATIO) {
+		event->pmu_private = kzalloc(sizeof(struct tx2_metric_state),
+				GFP_KERNEL);
+		if (!event->pmu_private)
+			return -ENOMEM;
+		event->destroy = tx2_uncore_event_destroy;
+	}
+
+	return 0;
+}
+
+/* Limit the slack, counters may not advance more than 3/4 of their range */
+static u64 tx2_uncore_timer_slack(u64 interval)
+{
+	return min_t(u64, (u64)READ_ONCE(timer_slack_us) * NSEC_PER_USEC,
+			interval / 2);
+}
+
+/*
+ * Arm the node timer to expire within @interval, an armed timer is
+ * only moved earlier. Called with interrupts disabled, on the node CPU.
+ */
+static void tx2_uncore_node_arm(struct tx2_uncore_node *tx2_node,
+		u64 interval)
+{
+	struct hrtimer *timer = &tx2_node->hrtimer;
+
+	if (hrtimer_active(timer) &&
+	    ktime_to_ns(hrtimer_get_remaining(timer)) <= interval)
+		return;
+
+	hrtimer_start_range_ns(timer, ns_to_ktime(interval),
+			tx2_uncore_timer_slack(interval),
+			HRTIMER_MODE_REL_PINNED);
+}
+
+static void tx2_pmu_start_counter(struct tx2_uncore_pmu *tx2_pmu,
+		struct perf_event *event, int idx, u32 event_id)
+{
+	tx2_pmu->ops->start_event(event, idx, event_id);
+	tx2_pmu->cntr_programmed[idx] = event_id;
+}
+
+static void tx2_pmu_stop_counter(struct tx2_uncore_pmu *tx2_pmu,
+		struct perf_event *event, int idx)
+{
+	tx2_pmu->ops->stop_event(event, idx);
+	tx2_pmu->cntr_programmed[idx] = 0;
+}
+
+/*
+ * Drop what the stopped counters of @mask counted since their cntr_last
+ * events were last read.
+ */
+static void tx2_pmu_discard_counts(struct tx2_uncore_pmu *tx2_pmu,
+		unsigned long mask)
+{
+	u32 counters[TX2_PMU_MAX_COUNTERS];
+	int idx;
+
+	if (!tx2_pmu->ops->reset_counter && tx2_pmu->batch_read &&
+	    hweight_long(mask) > 1 &&
+	    !tx2_pmu_read_counters(tx2_pmu, mask, counters))
+		return;
+
+	for_each_set_bit(idx, &mask, tx2_pmu->max_counters) {
+		if (tx2_pmu->ops->reset_counter)
+			tx2_pmu->ops->reset_counter(tx2_pmu->cntr_last[idx], idx);
+		else
+			tx2_pmu->ops->read_counter(tx2_pmu->cntr_last[idx], idx);
+	}
+}
+
+/*
+ * Stop a counter left counting by tx2_uncore_event_stop, and drop what it
+ * counted since. Its event was stopped in the same pmu_disable/pmu_enable
+ * section, perf does not free it before pmu_enable.
+ */
+static void tx2_pmu_stop_pending(struct tx2_uncore_pmu *tx2_pmu, int idx)
+{
+	__clear_bit(idx, &tx2_pmu->pending_stop);
+	tx2_pmu_stop_counter(tx2_pmu, tx2_pmu->cntr_last[idx], idx);
+	tx2_pmu_discard_counts(tx2_pmu, BIT(idx));
+}
+
+static void tx2_uncore_event_start(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	struct tx2_uncore_node *tx2_node;
+	struct tx2_uncore_pmu *tx2_pmu;
+	unsigned long irq_flags;
+	bool moved = false;
+	u64 interval;
+	int idx;
+
+	hwc->state = 0;
+	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	tx2_node = tx2_pmu->tx2_node;
+
+	interval = tx2_node->hrtimer_interval;
+	raw_spin_lock_irqsave(&tx2_pmu->lock, irq_flags);
+	for_each_event_counter(idx, tx2_pmu, event) {
+		if (tx2_pmu->deferred &&
+		    test_bit(idx, &tx2_pmu->pending_stop)) {
+			/* rescheduled on the counter it still counts on */
+			if (tx2_pmu->cntr_programmed[idx] ==
+				tx2_pmu->cntr_event[idx] &&
+			    tx2_pmu->cntr_last[idx]->hw.config == hwc->config) {
+				__clear_bit(idx, &tx2_pmu->pending_stop);
+				goto started;
+			}
+			tx2_pmu_stop_pending(tx2_pmu, idx);
+		}
+		if (tx2_pmu->deferred) {
+			if (tx2_pmu->ops->reset_counter)
+				tx2_pmu->ops->reset_counter(event, idx);
+			__set_bit(idx, &tx2_pmu->pending_start);
+		} else {
+			tx2_pmu_start_counter(tx2_pmu, event, idx,
+					tx2_pmu->cntr_event[idx]);
+		}
+		tx2_pmu->smc_read_ns[idx] = ktime_get_ns();
+started:
+		tx2_uncore_user_update(tx2_pmu, idx, event);
+		moved |= tx2_pmu->cntr_last[idx] != event;
+		tx2_pmu->cntr_last[idx] = event;
+		tx2_pmu->last_sync[idx] = ktime_get_ns();
+		if (lazy_sampling)
+			interval = min(interval, tx2_uncore_wrap_ns(tx2_pmu, idx));
+	}
+	raw_spin_unlock_irqrestore(&tx2_pmu->lock, irq_flags);
+	local64_set(&hwc->prev_count, local64_read(&event->count));
+	if (GET_HIST(event)) {
+		struct tx2_hist_state *hist = event->pmu_private;
+
+		/* rates are over the time counted, since the last sample */
+		hist->prev_count = local64_read(&event->count);
+		hist->prev_time = ktime_get_ns();
+	}
+	/* the user page has no counter index, only rewrite it for a move */
+	if (moved)
+		tx2_event_update_userpage(event);
+
+	/*
+	 * Start timer for first event of the node. Events are rescheduled
+	 * on every multiplexing rotation, an already armed timer is not
+	 * pushed out so that rotation does not keep delaying the sample.
+	 */
+	if (!hrtimer_active(&tx2_node->hrtimer))
+		tx2_node->last_sample = ktime_get();
+	tx2_uncore_node_arm(tx2_node, interval);
+}
+
+static void tx2_uncore_event_stop(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	struct tx2_uncore_pmu *tx2_pmu;
+	unsigned long irq_flags;
+	int idx;
+
+	if (hwc->state & PERF_HES_UPTODATE)
+		return;
+
+	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	raw_spin_lock_irqsave(&tx2_pmu->lock, irq_flags);
+	for_each_event_counter(idx, tx2_pmu, event) {
+		if (tx2_pmu->deferred) {
+			/* not started yet */
+			if (__test_and_clear_bit(idx, &tx2_pmu->pending_start))
+				continue;
+			/*
+			 * Left counting until pmu_enable, perf often
+			 * reschedules the event on the same counter meanwhile.
+			 */
+			__set_bit(idx, &tx2_pmu->pending_stop);
+			continue;
+		}
+		tx2_pmu_stop_counter(tx2_pmu, event, idx);
+	}
+	raw_spin_unlock_irqrestore(&tx2_pmu->lock, irq_flags);
+	WARN_ON_ONCE(hwc->state & PERF_HES_STOPPED);
+	hwc->state |= PERF_HES_STOPPED;
+	if (flags & PERF_EF_UPDATE) {
+		tx2_uncore_event_update(event);
+		hwc->state |= PERF_HES_UPTODATE;
+	}
+}
+
+static int tx2_uncore_event_add(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	const struct tx2_uncore_metric *metric;
+	struct tx2_uncore_pmu *tx2_pmu;
+	int i, idx, nr_counters;
+	unsigned long irq_flags;
+	u32 event_id;
+
+	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	metric = tx2_event_metric(event);
+	nr_counters = tx2_event_nr_counters(event);
+
+	/* Allocate a free counter, one per event of a metric */
+	raw_spin_lock_irqsave(&tx2_pmu->lock, irq_flags);
+	for (i = 0; i < nr_counters; i++) {
+		event_id = metric ? metric->events[i] : GET_EVENTID(event);
+		idx = alloc_counter(tx2_pmu, event, event_id);
+		if (idx < 0) {
+			for_each_event_counter(idx, tx2_pmu, event) {
+				tx2_pmu->events[idx] = NULL;
+				free_counter(tx2_pmu, idx);
+			}
+			raw_spin_unlock_irqrestore(&tx2_pmu->lock, irq_flags);
+			return -EAGAIN;
+		}
+		if (!i)
+			hwc->idx = idx;
+		tx2_pmu->events[idx] = event;
+		tx2_pmu->cntr_event[idx] = event_id;
+		tx2_pmu->cntr_metric_idx[idx] = i;
+	}
+	raw_spin_unlock_irqrestore(&tx2_pmu->lock, irq_flags);
+
+	hwc->state = PERF_HES_UPTODATE | PERF_HES_STOPPED;
+	if (flags & PERF_EF_START)
+		tx2_uncore_event_start(event, flags);
+
+	return 0;
+}
+
+static void tx2_uncore_event_del(struct perf_event *event, int flags)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	struct hw_perf_event *hwc = &event->hw;
+	unsigned long irq_flags;
+	int idx;
+
+	tx2_uncore_event_stop(event, PERF_EF_UPDATE);
+
+	/* clear the assigned counters */
+	raw_spin_lock_irqsave(&tx2_pmu->lock, irq_flags);
+	for_each_event_counter(idx, tx2_pmu, event) {
+		tx2_pmu->events[idx] = NULL;
+		free_counter(tx2_pmu, idx);
+		tx2_uncore_user_update(tx2_pmu, idx, NULL);
+	}
+	raw_spin_unlock_irqrestore(&tx2_pmu->lock, irq_flags);
+
+	hwc->idx = -1;
+}
+
+static void tx2_uncore_event_read(struct perf_event *event)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+
+	/* a group read updated all events at the start of the transaction */
+	if (*this_cpu_ptr(tx2_pmu->txn_flags) & PERF_PMU_TXN_READ)
+		return;
+
+	tx2_uncore_event_update(event);
+}
+
+/*
+ * The perf core disables the PMU while it schedules events, and wraps
+ * group scheduling in pmu_disable/pmu_enable. The counters are left as
+ * they are: events stopped meanwhile are read and their counter left
+ * counting, so that an event rescheduled on it just goes on counting.
+ * Starting counters, and stopping those of the events not rescheduled,
+ * is deferred until pmu_enable, which starts them all at once, skew free.
+ */
+static void tx2_uncore_pmu_disable(struct pmu *pmu)
+{
+	pmu_to_tx2_pmu(pmu)->deferred = true;
+}
+
+static void tx2_uncore_pmu_enable(struct pmu *pmu)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(pmu);
+	u32 event_ids[TX2_PMU_MAX_COUNTERS];
+	unsigned long flags, start, stop;
+	int idx;
+
+	tx2_pmu->deferred = false;
+	/* no counter changed, e.g. events rescheduled on their counters */
+	start = tx2_pmu->pending_start;
+	stop = tx2_pmu->pending_stop;
+	if (!start && !stop)
+		return;
+	tx2_pmu->pending_start = 0;
+	tx2_pmu->pending_stop = 0;
+
+	/* the counters of events not rescheduled are stopped along */
+	for_each_set_bit(idx, &start, tx2_pmu->max_counters)
+		event_ids[idx] = tx2_pmu->cntr_event[idx];
+	for_each_set_bit(idx, &stop, tx2_pmu->max_counters)
+		event_ids[idx] = 0;
+
+	raw_spin_lock_irqsave(&tx2_pmu->lock, flags);
+	if (!tx2_pmu->ops->startstop_counters ||
+	    tx2_pmu->ops->startstop_counters(tx2_pmu, start | stop,
+			event_ids)) {
+		for_each_set_bit(idx, &stop, tx2_pmu->max_counters)
+			tx2_pmu_stop_counter(tx2_pmu, tx2_pmu->cntr_last[idx],
+					idx);
+		for_each_set_bit(idx, &start, tx2_pmu->max_counters)
+			tx2_pmu_start_counter(tx2_pmu, tx2_pmu->events[idx],
+					idx, event_ids[idx]);
+	} else {
+		start |= stop;
+		for_each_set_bit(idx, &start, tx2_pmu->max_counters)
+			tx2_pmu->cntr_programmed[idx] = event_ids[idx];
+	}
+	if (stop)
+		tx2_pmu_discard_counts(tx2_pmu, stop);
+	raw_spin_unlock_irqrestore(&tx2_pmu->lock, flags);
+}
+
+/*
+ * Next sampling interval, such that the fastest counter advances by at
+ * most half its 32 bit range until then, given the count @delta it
+ * advanced during the last @elapsed ns.
+ */
+static u64 tx2_uncore_next_interval(struct tx2_uncore_pmu *tx2_pmu,
+		u64 delta, u64 elapsed)
+{
+	u64 interval = READ_ONCE(tx2_pmu->hrtimer_interval_max);
+	u64 interval_min = READ_ONCE(tx2_pmu->hrtimer_interval_min);
+	u64 scaled;
+
+	if (delta) {
+		/* elapsed * 2^31 / delta, without overflowing 64 bit */
+		elapsed = min(elapsed, interval);
+		scaled = div64_u64(elapsed << 15, delta);
+		if (scaled < (interval >> 16))
+			interval = scaled << 16;
+	}
+
+	return max(interval, interval_min);
+}
+
+/* Publish the counts of all active counters to the snapshot ring */
+static void tx2_uncore_snapshot(struct tx2_uncore_pmu *tx2_pmu, ktime_t now)
+{
+	struct tx2_snapshot_ring *ring = tx2_snapshot_ring;
+	struct tx2_snapshot_entry *entry;
+	struct perf_event *event;
+	unsigned long flags;
+	u32 slot;
+	int idx;
+
+	if (!ring)
+		return;
+
+	raw_spin_lock_irqsave(&tx2_snapshot_lock, flags);
+	div_u64_rem(ring->head, ring->nr_entries, &slot);
+	entry = &ring->entries[slot];
+	WRITE_ONCE(entry->seq, entry->seq + 1);
+	smp_wmb();
+
+	entry->node = tx2_pmu->node;
+	entry->type = tx2_pmu->type;
+	entry->counters = 0;
+	entry->time = ktime_to_ns(now);
+	for (idx = 0; idx < tx2_pmu->max_counters; idx++) {
+		event = tx2_pmu->events[idx];
+		entry->config[idx] = event ? event->attr.config : 0;
+		entry->count[idx] = event ? local64_read(&event->count) : 0;
+		if (event)
+			entry->counters |= BIT(idx);
+	}
+
+	smp_wmb();
+	WRITE_ONCE(entry->seq, entry->seq + 1);
+	WRITE_ONCE(ring->head, ring->head + 1);
+	raw_spin_unlock_irqrestore(&tx2_snapshot_lock, flags);
+}
+
+/*
+ * Lazy sampling, reads and removal of the events sync the counters. Read
+ * the counters only when close to their wrap deadline, return the time
+ * until the next deadline.
+ */
+static u64 tx2_uncore_pmu_sample_lazy(struct tx2_uncore_pmu *tx2_pmu,
+		ktime_t now)
+{
+	u64 interval_min = READ_ONCE(tx2_pmu->hrtimer_interval_min);
+	u64 deadline, next = TX2_PMU_HRTIMER_INTERVAL_LIMIT;
+	u64 t = ktime_to_ns(now);
+	struct perf_event *event;
+	unsigned long flags;
+	bool read = false;
+	int idx;
+
+	for_each_set_bit(idx, tx2_pmu->active_counters,
+			tx2_pmu->max_counters) {
+		raw_spin_lock_irqsave(&tx2_pmu->lock, flags);
+		event = tx2_pmu->events[idx];
+		if (event) {
+			deadline = tx2_pmu->last_sync[idx] +
+				tx2_uncore_wrap_ns(tx2_pmu, idx);
+			if (deadline <= t + interval_min) {
+				__tx2_uncore_event_update(event, idx,
+					tx2_pmu->ops->read_counter(event, idx));
+				deadline = tx2_pmu->last_sync[idx] +
+					tx2_uncore_wrap_ns(tx2_pmu, idx);
+				read = true;
+			}
+			next = min(next, deadline - t);
+		}
+		raw_spin_unlock_irqrestore(&tx2_pmu->lock, flags);
+	}
+
+	if (read)
+		tx2_uncore_snapshot(tx2_pmu, now);
+
+	return max(next, interval_min);
+}
+
+/*
+ * Update the events of all active counters, reading them in one SMC call
+ * if supported. Events may be added or removed by interrupts while
+ * sampling from the work item, otherwise the lock is held for one counter
+ * read at a time only.
+ */
+static void tx2_uncore_pmu_update(struct tx2_uncore_pmu *tx2_pmu)
+{
+	int max_counters = tx2_pmu->max_counters;
+	struct perf_event *event;
+	unsigned long flags;
+	int idx;
+
+	if (tx2_pmu->batch_read) {
+		u32 counters[TX2_PMU_MAX_COUNTERS];
+
+		raw_spin_lock_irqsave(&tx2_pmu->lock, flags);
+		if (!tx2_pmu_read_counters(tx2_pmu,
+				*tx2_pmu->active_counters, counters)) {
+			tx2_pmu->batch_errors = 0;
+			for_each_set_bit(idx, tx2_pmu->active_counters,
+					max_counters)
+				__tx2_uncore_event_update(tx2_pmu->events[idx],
+						idx, counters[idx]);
+			raw_spin_unlock_irqrestore(&tx2_pmu->lock, flags);
+			return;
+		}
+		/* Fall back to reading the counters one by one */
+		if (++tx2_pmu->batch_errors >= TX2_SMC_MAX_ERRORS)
+			tx2_pmu->batch_read = false;
+		raw_spin_unlock_irqrestore(&tx2_pmu->lock, flags);
+		dev_err_ratelimited(tx2_pmu->dev,
+			"SMC to read counters failed for PMU UNCORE[%s]\n",
+				tx2_pmu->name);
+	}
+
+	for_each_set_bit(idx, tx2_pmu->active_counters, max_counters) {
+		raw_spin_lock_irqsave(&tx2_pmu->lock, flags);
+		event = tx2_pmu->events[idx];
+		if (event)
+			__tx2_uncore_event_update(event, idx,
+					tx2_pmu->ops->read_counter(event, idx));
+		raw_spin_unlock_irqrestore(&tx2_pmu->lock, flags);
+	}
+}
+
+/*
+ * Emit a sample if the count rate of a sampling event since the previous
+ * sample, @elapsed ns ago, is at least its sample_period per second. The
+ * counters have no overflow interrupt, this notifies users of a rate
+ * within a sampling interval.
+ */
+static void tx2_uncore_event_threshold(struct perf_event *event, u64 elapsed)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	struct perf_sample_data data;
+	struct pt_regs *regs, caller_regs;
+	u64 count, delta;
+
+	count = local64_read(&event->count);
+	delta = count - local64_xchg(&hwc->prev_count, count);
+	elapsed /= NSEC_PER_USEC;
+	if (!elapsed ||
+	    div64_u64(delta * USEC_PER_SEC, elapsed) < hwc->sample_period)
+		return;
+
+	/* the work item runs without interrupt registers */
+	regs = get_irq_regs();
+	if (!regs) {
+		perf_fetch_caller_regs(&caller_regs);
+		regs = &caller_regs;
+	}
+
+	perf_sample_data_init(&data, 0, hwc->last_period);
+	if (perf_event_overflow(event, &data, regs))
+		tx2_uncore_event_stop(event, 0);
+}
+
+/* Account the rate of a histogram event since the previous sample */
+static void tx2_uncore_event_hist(struct perf_event *event)
+{
+	struct tx2_hist_state *hist = event->pmu_private;
+	u64 count = local64_read(&event->count);
+	u64 now = ktime_get_ns();
+	u64 elapsed = now - hist->prev_time;
+	u64 rate;
+
+	if (elapsed < NSEC_PER_USEC)
+		return;
+
+	rate = div64_u64((count - hist->prev_count) * USEC_PER_SEC,
+			elapsed / NSEC_PER_USEC);
+	hist->hist[min_t(int, fls64(rate), TX2_HIST_BUCKETS - 1)]++;
+	hist->intervals++;
+	hist->max_rate = max(hist->max_rate, rate);
+	hist->prev_count = count;
+	hist->prev_time = now;
+}
+
+/*
+ * Account the rates of the histogram events, and check those of the
+ * sampling events against their thresholds, @elapsed ns after the
+ * previous sample.
+ */
+static void tx2_uncore_pmu_rates(struct tx2_uncore_pmu *tx2_pmu, u64 elapsed)
+{
+	struct perf_event *event;
+	unsigned long flags;
+	int idx;
+
+	/* once per event, at its first counter */
+	for_each_set_bit(idx, tx2_pmu->active_counters,
+			tx2_pmu->max_counters) {
+		local_irq_save(flags);
+		event = tx2_pmu->events[idx];
+		if (event && event->hw.idx == idx &&
+		    !(event->hw.state & PERF_HES_STOPPED)) {
+			if (GET_HIST(event))
+				tx2_uncore_event_hist(event);
+			if (is_sampling_event(event))
+				tx2_uncore_event_threshold(event, elapsed);
+		}
+		local_irq_restore(flags);
+	}
+}
+
+/*
+ * Read all active counters of the PMU at @now, return the next sampling
+ * interval the PMU needs, @elapsed ns after the previous sample.
+ */
+static u64 tx2_uncore_pmu_sample(struct tx2_uncore_pmu *tx2_pmu, ktime_t now,
+		u64 elapsed)
+{
+	int max_counters = tx2_pmu->max_counters;
+	u64 delta = 0;
+	int idx;
+
+	if (lazy_sampling)
+		return tx2_uncore_pmu_sample_lazy(tx2_pmu, now);
+
+	tx2_uncore_pmu_update(tx2_pmu);
+	tx2_uncore_pmu_rates(tx2_pmu, elapsed);
+
+	/*
+	 * Adapt the interval to the fastest counter. Counting all channels
+	 * sums them up, which overestimates the rate of a single counter.
+	 */
+	for (idx = 0; idx < max_counters; idx++)
+		delta = max_t(u64, delta,
+				local64_xchg(&tx2_pmu->sample_count[idx], 0));
+
+	tx2_uncore_snapshot(tx2_pmu, now);
+
+	return tx2_uncore_next_interval(tx2_pmu, delta, elapsed);
+}
+
+/*
+ * Sample the PMUs of the node together, return the interval the fastest
+ * needs until the next sample, 0 if none is counting.
+ */
+static u64 tx2_uncore_node_sample(struct tx2_uncore_node *tx2_node)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+	u64 elapsed, interval = U64_MAX;
+	ktime_t now;
+	int i;
+
+	now = ktime_get();
+	elapsed = ktime_to_ns(ktime_sub(now, tx2_node->last_sample));
+
+	for (i = 0; i < PMU_TYPE_INVALID; i++) {
+		tx2_pmu = tx2_node->pmus[i];
+		if (!tx2_pmu || bitmap_empty(tx2_pmu->active_counters,
+					tx2_pmu->max_counters))
+			continue;
+		interval = min(interval,
+				tx2_uncore_pmu_sample(tx2_pmu, now, elapsed));
+	}
+
+	if (interval == U64_MAX)
+		return 0;
+
+	tx2_node->hrtimer_interval = interval;
+	tx2_node->last_sample = now;
+	return interval;
+}
+
+static void tx2_uncore_node_work(struct work_struct *work)
+{
+	struct tx2_uncore_node *tx2_node;
+	unsigned long flags;
+	u64 interval, start;
+
+	tx2_node = container_of(work, struct tx2_uncore_node, work);
+	start = ktime_get_ns();
+	interval = tx2_uncore_node_sample(tx2_node);
+	tx2_stat_add(&tx2_node->sample_stat, ktime_get_ns() - start, false);
+	if (!interval)
+		return;
+
+	/* events started meanwhile may have armed the timer already */
+	local_irq_save(flags);
+	tx2_uncore_node_arm(tx2_node, interval);
+	local_irq_restore(flags);
+}
+
+static enum hrtimer_restart tx2_hrtimer_callback(struct hrtimer *timer)
+{
+	struct tx2_uncore_node *tx2_node;
+	u64 interval, start;
+
+	tx2_node = container_of(timer, struct tx2_uncore_node, hrtimer);
+	start = ktime_get_ns();
+	tx2_stat_add(&tx2_node->timer_latency,
+		     max_t(s64, 0, start - ktime_to_ns(hrtimer_get_expires(timer))),
+		     false);
+
+	/* The work item samples and rearms the timer, on the node CPU */
+	if (sample_in_work) {
+		queue_work_on(tx2_node->cpu, system_wq, &tx2_node->work);
+		return HRTIMER_NORESTART;
+	}
+
+	interval = tx2_uncore_node_sample(tx2_node);
+	tx2_stat_add(&tx2_node->sample_stat, ktime_get_ns() - start, false);
+	if (!interval)
+		return HRTIMER_NORESTART;
+
+	tx2_node->timer_overruns +=
+		hrtimer_forward_now(timer, ns_to_ktime(interval)) - 1;
+	hrtimer_set_expires_range_ns(timer, hrtimer_get_softexpires(timer),
+			tx2_uncore_timer_slack(interval));
+	return HRTIMER_RESTART;
 }
 
-static bool tx2_uncore_validate_event(struct pmu *pmu,
-				  struct perf_event *event, int *counters)
+/*
+ * Scheduling a group is done with the PMU disabled. Reading a group,
+ * the counters of all events are read at the start, in a single SMC call
+ * if supported, and the reads of the events themselves do nothing.
+ */
+static void tx2_uncore_start_txn(struct pmu *pmu, unsigned int txn_flags)
 {
-	if (is_software_event(event))
-		return true;
-	/* Reject groups spanning multiple HW PMUs. */
-	if (event->pmu != pmu)
-		return false;
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(pmu);
+	unsigned int *flags = this_cpu_ptr(tx2_pmu->txn_flags);
 
-	*counters = *counters + 1;
-	return true;
+	WARN_ON_ONCE(*flags);
+	if (txn_flags & PERF_PMU_TXN_READ)
+		tx2_uncore_pmu_update(tx2_pmu);
+
+	*flags = txn_flags;
+	if (txn_flags == PERF_PMU_TXN_ADD)
+		perf_pmu_disable(pmu);
+}
+
+static int tx2_uncore_commit_txn(struct pmu *pmu)
+{
+	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(pmu);
+	unsigned int *flags = this_cpu_ptr(tx2_pmu->txn_flags);
+	unsigned int txn_flags = *flags;
+
+	*flags = 0;
+	if (txn_flags == PERF_PMU_TXN_ADD)
+		perf_pmu_enable(pmu);
+
+	return 0;
+}
+
+static void tx2_uncore_cancel_txn(struct pmu *pmu)
+{
+	tx2_uncore_commit_txn(pmu);
+}
+
+static int tx2_uncore_pmu_register(
+		struct tx2_uncore_pmu *tx2_pmu)
+{
+	struct device *dev = tx2_pmu->dev;
+	char *name = tx2_pmu->name;
+	int ret;
+
+	tx2_pmu->txn_flags = alloc_percpu(unsigned int);
+	if (!tx2_pmu->txn_flags)
+		return -ENOMEM;
+
+	/* Perf event registration */
+	tx2_pmu->pmu = (struct pmu) {
+		.module         = THIS_MODULE,
+		.attr_groups	= tx2_pmu->attr_groups,
+		.task_ctx_nr	= perf_invalid_context,
+		.hrtimer_interval_ms = TX2_PMU_MUX_INTERVAL_MS,
+		.pmu_enable	= tx2_uncore_pmu_enable,
+		.pmu_disable	= tx2_uncore_pmu_disable,
+		.start_txn	= tx2_uncore_start_txn,
+		.commit_txn	= tx2_uncore_commit_txn,
+		.cancel_txn	= tx2_uncore_cancel_txn,
+		.event_init	= tx2_uncore_event_init,
+		.add		= tx2_uncore_event_add,
+		.del		= tx2_uncore_event_del,
+		.start		= tx2_uncore_event_start,
+		.stop		= tx2_uncore_event_stop,
+		.read		= tx2_uncore_event_read,
+	};
+
+	tx2_pmu->pmu.name = devm_kasprintf(dev, GFP_KERNEL,
+			"%s", name);
+
+	ret = perf_pmu_register(&tx2_pmu->pmu, tx2_pmu->pmu.name, -1);
+	if (ret)
+		free_percpu(tx2_pmu->txn_flags);
+	return ret;
+}
+
+static void tx2_uncore_pmu_unregister(struct tx2_uncore_pmu *tx2_pmu)
+{
+	perf_pmu_unregister(&tx2_pmu->pmu);
+	free_percpu(tx2_pmu->txn_flags);
 }
 
 /*
- * Make sure the group of events can be scheduled at once
- * on the PMU.
+ * Events counted through events of other PMUs, their group can only
+ * hold events of the same PMU and software events.
  */
-static bool tx2_uncore_validate_event_group(struct perf_event *event)
+static bool tx2_uncore_validate_group_pmu(struct perf_event *event)
 {
 	struct perf_event *sibling, *leader = event->group_leader;
-	int counters = 0;
-
-	if (event->group_leader == event)
-		return true;
 
-	if (!tx2_uncore_validate_event(event->pmu, leader, &counters))
+	if (leader != event && !is_software_event(leader) &&
+	    leader->pmu != event->pmu)
 		return false;
-
 	for_each_sibling_event(sibling, leader) {
-		if (!tx2_uncore_validate_event(event->pmu, sibling, &counters))
+		if (!is_software_event(sibling) && sibling->pmu != event->pmu)
 			return false;
 	}
+	return true;
+}
 
-	if (!tx2_uncore_validate_event(event->pmu, event, &counters))
-		return false;
+/*
+ * Sum of the per socket events. The counters of every socket are read
+ * from the CPU of the aggregate event, under the lock of their PMU, so a
+ * read of the aggregate does not need an IPI per socket.
+ */
+static u64 tx2_uncore_aggr_count(struct perf_event *event)
+{
+	struct tx2_aggr_event *aggr_event = event->pmu_private;
+	struct tx2_metric_state *state;
+	u64 count = 0, num = 0, den = 0;
+	struct perf_event *child;
+	int i;
+
+	for (i = 0; i < aggr_event->nr_events; i++) {
+		child = aggr_event->events[i];
+		tx2_uncore_event_update(child);
+
+		/* a ratio of the sums, not a sum of the ratios */
+		if (aggr_event->ratio) {
+			state = child->pmu_private;
+			num += local64_read(&state->count[0]);
+			den += local64_read(&state->count[1]);
+		} else {
+			count += local64_read(&child->count);
+		}
+	}
 
-	/*
-	 * If the group requires more counters than the HW has,
-	 * it cannot ever be scheduled.
-	 */
-	return counters <= TX2_PMU_MAX_COUNTERS;
+	if (den)
+		count = tx2_metric_ratio(num, den);
+	return count;
 }
 
+static void tx2_uncore_aggr_update(struct perf_event *event)
+{
+	struct tx2_aggr_event *aggr_event = event->pmu_private;
+	u64 prev, new;
 
-static int tx2_uncore_event_init(struct perf_event *event)
+	new = tx2_uncore_aggr_count(event);
+	if (aggr_event->ratio) {
+		local64_set(&event->count, new);
+		return;
+	}
+
+	prev = local64_xchg(&event->hw.prev_count, new);
+	local64_add(new - prev, &event->count);
+}
+
+static void tx2_uncore_aggr_destroy(struct perf_event *event)
 {
-	struct hw_perf_event *hwc = &event->hw;
+	struct tx2_aggr_event *aggr_event = event->pmu_private;
+	int i;
+
+	for (i = 0; i < aggr_event->nr_events; i++)
+		perf_event_release_kernel(aggr_event->events[i]);
+	kfree(aggr_event);
+}
+
+/*
+ * Count the event on the PMU of every socket with pinned kernel events,
+ * which are not multiplexed out by other events.
+ */
+static int tx2_uncore_aggr_event_init(struct perf_event *event)
+{
+	struct tx2_uncore_aggr *tx2_aggr = pmu_to_tx2_aggr(event->pmu);
+	struct tx2_aggr_event *aggr_event;
+	struct perf_event *child;
 	struct tx2_uncore_pmu *tx2_pmu;
+	struct perf_event_attr attr;
+	int ret = 0;
 
-	/* Test the event attr type check for PMU enumeration */
 	if (event->attr.type != event->pmu->type)
 		return -ENOENT;
 
-	/*
-	 * SOC PMU counters are shared across all cores.
-	 * Therefore, it does not support per-process mode.
-	 * Also, it does not support event sampling mode.
-	 */
 	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
 		return -EINVAL;
 
-	/* We have no filtering of any kind */
-	if (event->attr.exclude_user	||
-	    event->attr.exclude_kernel	||
-	    event->attr.exclude_hv	||
-	    event->attr.exclude_idle	||
-	    event->attr.exclude_host	||
-	    event->attr.exclude_guest)
+	if (event->cpu < 0)
 		return -EINVAL;
 
-	if (event->cpu < 0)
+	/* The children count on their own PMUs, groups only share the CPU */
+	if (!tx2_uncore_validate_group_pmu(event))
 		return -EINVAL;
 
-	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
-	if (tx2_pmu->cpu >= nr_cpu_ids)
+	attr = event->attr;
+	attr.pinned = 1;
+	attr.disabled = 0;
+	attr.inherit = 0;
+	attr.read_format = 0;
+
+	mutex_lock(&tx2_pmu_cpu_lock);
+	if (!tx2_aggr->registered || tx2_aggr->tx2_node->cpu >= nr_cpu_ids) {
+		ret = -ENODEV;
+		goto out;
+	}
+	event->cpu = tx2_aggr->tx2_node->cpu;
+#ifdef PERF_EV_CAP_READ_ACTIVE_PKG
+	event->event_caps |= PERF_EV_CAP_READ_ACTIVE_PKG;
+#endif
+
+	aggr_event = kzalloc(sizeof(*aggr_event) +
+			tx2_aggr->nr_pmus * sizeof(aggr_event->events[0]),
+			GFP_KERNEL);
+	if (!aggr_event) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	event->pmu_private = aggr_event;
+
+	list_for_each_entry(tx2_pmu, &tx2_pmus, entry) {
+		if (tx2_pmu->type != tx2_aggr->type ||
+		    tx2_pmu->tx2_node->cpu >= nr_cpu_ids)
+			continue;
+
+		attr.type = tx2_pmu->pmu.type;
+		child = perf_event_create_kernel_counter(&attr,
+				tx2_pmu->tx2_node->cpu, NULL, NULL, NULL);
+		if (IS_ERR(child)) {
+			ret = PTR_ERR(child);
+			tx2_uncore_aggr_destroy(event);
+			event->pmu_private = NULL;
+			goto out;
+		}
+		aggr_event->events[aggr_event->nr_events++] = child;
+		aggr_event->ratio = tx2_event_metric(child) &&
+			tx2_event_metric(child)->type == METRIC_TYPE_RATIO;
+	}
+
+	if (!aggr_event->nr_events) {
+		ret = -ENODEV;
+		tx2_uncore_aggr_destroy(event);
+		event->pmu_private = NULL;
+		goto out;
+	}
+	event->destroy = tx2_uncore_aggr_destroy;
+out:
+	mutex_unlock(&tx2_pmu_cpu_lock);
+	return ret;
+}
+
+static void tx2_uncore_aggr_event_start(struct perf_event *event, int flags)
+{
+	local64_set(&event->hw.prev_count, tx2_uncore_aggr_count(event));
+	event->hw.state = 0;
+	tx2_event_update_userpage(event);
+}
+
+static void tx2_uncore_aggr_event_stop(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hwc = &event->hw;
+
+	if (hwc->state & PERF_HES_STOPPED)
+		return;
+
+	tx2_uncore_aggr_update(event);
+	hwc->state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+}
+
+static int tx2_uncore_aggr_event_add(struct perf_event *event, int flags)
+{
+	event->hw.state = PERF_HES_UPTODATE | PERF_HES_STOPPED;
+	if (flags & PERF_EF_START)
+		tx2_uncore_aggr_event_start(event, flags);
+
+	return 0;
+}
+
+static void tx2_uncore_aggr_event_del(struct perf_event *event, int flags)
+{
+	tx2_uncore_aggr_event_stop(event, PERF_EF_UPDATE);
+	tx2_event_update_userpage(event);
+}
+
+static void tx2_uncore_aggr_event_read(struct perf_event *event)
+{
+	tx2_uncore_aggr_update(event);
+}
+
+/*
+ * Bandwidth attribution. An event of the attribution PMU on a CPU counts
+ * the DMC traffic of the socket of the CPU while it is scheduled in,
+ * shared with the other CPUs of the socket running attribution events
+ * meanwhile. Opened for a cgroup, perf schedules it on the context
+ * switches in and out of the cgroup tasks. The traffic is the count of a
+ * pinned source event of the socket as of its last timer sample: context
+ * switches do not access the counters.
+ */
+static int tx2_uncore_attrib_get_src(struct tx2_uncore_pmu *tx2_pmu, int src)
+{
+	struct perf_event_attr attr = {
+		.type		= tx2_pmu->pmu.type,
+		.size		= sizeof(attr),
+		.config		= dmc_attrib_events[src],
+		.pinned		= 1,
+	};
+	struct perf_event *event;
+
+	if (tx2_pmu->attrib_users[src]++)
+		return 0;
+
+	event = perf_event_create_kernel_counter(&attr, tx2_pmu->tx2_node->cpu,
+			NULL, NULL, NULL);
+	if (IS_ERR(event)) {
+		tx2_pmu->attrib_users[src] = 0;
+		return PTR_ERR(event);
+	}
+	/* installed on an online CPU, a pinned event is scheduled at once */
+	if (READ_ONCE(event->state) != PERF_EVENT_STATE_ACTIVE) {
+		perf_event_release_kernel(event);
+		tx2_pmu->attrib_users[src] = 0;
+		return -EBUSY;
+	}
+	tx2_pmu->attrib_count[src] = 0;
+	tx2_pmu->attrib_share[src] = 0;
+	tx2_pmu->attrib_unshared[src] = 0;
+	tx2_pmu->attrib_src[src] = event;
+	return 0;
+}
+
+static void tx2_uncore_attrib_destroy(struct perf_event *event)
+{
+	struct tx2_attrib_event *attrib_event = event->pmu_private;
+	struct tx2_uncore_pmu *tx2_pmu = attrib_event->tx2_pmu;
+	int src = attrib_event->src;
+
+	mutex_lock(&tx2_pmu_cpu_lock);
+	if (!--tx2_pmu->attrib_users[src]) {
+		perf_event_release_kernel(tx2_pmu->attrib_src[src]);
+		tx2_pmu->attrib_src[src] = NULL;
+	}
+	mutex_unlock(&tx2_pmu_cpu_lock);
+	kfree(attrib_event);
+}
+
+static int tx2_uncore_attrib_event_init(struct perf_event *event)
+{
+	struct tx2_attrib_event *attrib_event;
+	struct tx2_uncore_pmu *tx2_pmu;
+	int ret, src;
+
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
 		return -EINVAL;
-	event->cpu = tx2_pmu->cpu;
 
-	if (event->attr.config >= tx2_pmu->max_events)
+	if (event->cpu < 0)
 		return -EINVAL;
 
-	/* store event id */
-	hwc->config = event->attr.config;
+	for (src = 0; src < TX2_ATTRIB_EVENTS; src++) {
+		if (event->attr.config == dmc_attrib_events[src])
+			break;
+	}
+	if (src == TX2_ATTRIB_EVENTS)
+		return -EINVAL;
 
-	/* Validate the group */
-	if (!tx2_uncore_validate_event_group(event))
+	if (!tx2_uncore_validate_group_pmu(event))
 		return -EINVAL;
 
+	attrib_event = kzalloc(sizeof(*attrib_event), GFP_KERNEL);
+	if (!attrib_event)
+		return -ENOMEM;
+
+	mutex_lock(&tx2_pmu_cpu_lock);
+	ret = -ENODEV;
+	list_for_each_entry(tx2_pmu, &tx2_pmus, entry) {
+		if (tx2_pmu->type == PMU_TYPE_DMC &&
+		    tx2_pmu->node == cpu_to_node(event->cpu) &&
+		    tx2_pmu->tx2_node->cpu < nr_cpu_ids) {
+			ret = tx2_uncore_attrib_get_src(tx2_pmu, src);
+			break;
+		}
+	}
+	mutex_unlock(&tx2_pmu_cpu_lock);
+	if (ret) {
+		kfree(attrib_event);
+		return ret;
+	}
+
+	attrib_event->tx2_pmu = tx2_pmu;
+	attrib_event->src = src;
+	event->pmu_private = attrib_event;
+	event->destroy = tx2_uncore_attrib_destroy;
 	return 0;
 }
 
-static void tx2_uncore_event_start(struct perf_event *event, int flags)
+/*
+ * Share the increase of the source event since the previous scheduling of
+ * an attribution event among the CPUs that ran one meanwhile, and return
+ * the sum of the shares. The increase while none ran is only accounted
+ * in debugfs stats. Called with attrib_lock held.
+ */
+static u64 tx2_uncore_attrib_share(struct tx2_uncore_pmu *tx2_pmu, int src)
+{
+	u64 count, delta;
+
+	count = local64_read(&tx2_pmu->attrib_src[src]->count);
+	delta = count - tx2_pmu->attrib_count[src];
+	tx2_pmu->attrib_count[src] = count;
+	if (tx2_pmu->attrib_cpus[src])
+		tx2_pmu->attrib_share[src] += div_u64(delta << TX2_ATTRIB_SHIFT,
+				tx2_pmu->attrib_cpus[src]);
+	else
+		tx2_pmu->attrib_unshared[src] += delta;
+	return tx2_pmu->attrib_share[src];
+}
+
+/*
+ * Account the share of the event since it was last updated, and its CPU
+ * as running one more (@running > 0) or one fewer (< 0) attribution event
+ * of the source. Called on the CPU of the event.
+ */
+static void tx2_uncore_attrib_update(struct perf_event *event, int running)
+{
+	struct tx2_attrib_event *attrib_event = event->pmu_private;
+	struct tx2_uncore_pmu *tx2_pmu = attrib_event->tx2_pmu;
+	int src = attrib_event->src;
+	unsigned int *cpu_running;
+	unsigned long flags;
+	u64 share, prev;
+
+	raw_spin_lock_irqsave(&tx2_pmu->attrib_lock, flags);
+	share = tx2_uncore_attrib_share(tx2_pmu, src);
+	cpu_running = &this_cpu_ptr(&tx2_attrib_cpu)->running[src];
+	if (running > 0 && !(*cpu_running)++)
+		tx2_pmu->attrib_cpus[src]++;
+	else if (running < 0 && !--(*cpu_running))
+		tx2_pmu->attrib_cpus[src]--;
+	raw_spin_unlock_irqrestore(&tx2_pmu->attrib_lock, flags);
+
+	prev = local64_xchg(&event->hw.prev_count, share);
+	if (running <= 0)
+		local64_add((share >> TX2_ATTRIB_SHIFT) -
+				(prev >> TX2_ATTRIB_SHIFT), &event->count);
+}
+
+static void tx2_uncore_attrib_event_start(struct perf_event *event, int flags)
+{
+	tx2_uncore_attrib_update(event, 1);
+	event->hw.state = 0;
+}
+
+static void tx2_uncore_attrib_event_stop(struct perf_event *event, int flags)
 {
 	struct hw_perf_event *hwc = &event->hw;
-	struct tx2_uncore_pmu *tx2_pmu;
 
-	hwc->state = 0;
-	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	if (hwc->state & PERF_HES_STOPPED)
+		return;
 
-	tx2_pmu_startstop_counter(event, true);
-	perf_event_update_userpage(event);
+	tx2_uncore_attrib_update(event, -1);
+	hwc->state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+}
 
-	/* Start timer for first event */
-	if (bitmap_weight(tx2_pmu->active_counters,
-				tx2_pmu->max_counters) == 1) {
-		hrtimer_start(&tx2_pmu->hrtimer,
-			ns_to_ktime(tx2_pmu->hrtimer_interval),
-			HRTIMER_MODE_REL_PINNED);
-	}
+static int tx2_uncore_attrib_event_add(struct perf_event *event, int flags)
+{
+	event->hw.state = PERF_HES_UPTODATE | PERF_HES_STOPPED;
+	if (flags & PERF_EF_START)
+		tx2_uncore_attrib_event_start(event, flags);
+
+	return 0;
 }
 
-static void tx2_uncore_event_stop(struct perf_event *event, int flags)
+static void tx2_uncore_attrib_event_del(struct perf_event *event, int flags)
 {
-	struct hw_perf_event *hwc = &event->hw;
-	struct tx2_uncore_pmu *tx2_pmu;
+	tx2_uncore_attrib_event_stop(event, PERF_EF_UPDATE);
+}
 
-	if (hwc->state & PERF_HES_UPTODATE)
+static void tx2_uncore_attrib_event_read(struct perf_event *event)
+{
+	if (!(event->hw.state & PERF_HES_STOPPED))
+		tx2_uncore_attrib_update(event, 0);
+}
+
+/*
+ * Register the attribution PMU with the first DMC PMU, and unregister it
+ * with the last. Called with tx2_pmu_cpu_lock held.
+ */
+static void tx2_uncore_attrib_get(struct tx2_uncore_pmu *tx2_pmu)
+{
+	int ret;
+
+	if (tx2_pmu->type != PMU_TYPE_DMC || !attribution ||
+	    tx2_attrib_nr_pmus++)
 		return;
 
-	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
-	tx2_pmu_startstop_counter(event, false);
-	WARN_ON_ONCE(hwc->state & PERF_HES_STOPPED);
-	hwc->state |= PERF_HES_STOPPED;
-	if (flags & PERF_EF_UPDATE) {
-		tx2_uncore_event_update(event);
-		hwc->state |= PERF_HES_UPTODATE;
+	tx2_attrib_pmu = (struct pmu) {
+		.module		= THIS_MODULE,
+		.attr_groups	= dmc_attrib_attr_groups,
+		.task_ctx_nr	= perf_invalid_context,
+		.event_init	= tx2_uncore_attrib_event_init,
+		.add		= tx2_uncore_attrib_event_add,
+		.del		= tx2_uncore_attrib_event_del,
+		.start		= tx2_uncore_attrib_event_start,
+		.stop		= tx2_uncore_attrib_event_stop,
+		.read		= tx2_uncore_attrib_event_read,
+	};
+
+	ret = perf_pmu_register(&tx2_attrib_pmu, "uncore_dmc_attrib", -1);
+	if (ret)
+		pr_warn("TX2 PMU: Error %d registering attribution PMU\n", ret);
+	else
+		tx2_attrib_registered = true;
+}
+
+static void tx2_uncore_attrib_put(struct tx2_uncore_pmu *tx2_pmu)
+{
+	if (tx2_pmu->type != PMU_TYPE_DMC || !attribution ||
+	    --tx2_attrib_nr_pmus)
+		return;
+
+	if (tx2_attrib_registered)
+		perf_pmu_unregister(&tx2_attrib_pmu);
+	tx2_attrib_registered = false;
+}
+
+/*
+ * Register the aggregate PMU of the device type with its first PMU, it
+ * is hosted by the node of that PMU. Called with tx2_pmu_cpu_lock held.
+ */
+static void tx2_uncore_aggr_get(struct tx2_uncore_pmu *tx2_pmu)
+{
+	struct tx2_uncore_aggr *tx2_aggr = &tx2_aggrs[tx2_pmu->type];
+	int ret;
+
+	if (tx2_aggr->nr_pmus++)
+		return;
+
+	tx2_aggr->type = tx2_pmu->type;
+	tx2_aggr->tx2_node = tx2_pmu->tx2_node;
+	tx2_aggr->pmu = (struct pmu) {
+		.module		= THIS_MODULE,
+		.attr_groups	= tx2_pmu->type == PMU_TYPE_L3C ?
+			l3c_aggr_attr_groups : dmc_aggr_attr_groups,
+		.task_ctx_nr	= perf_invalid_context,
+		.event_init	= tx2_uncore_aggr_event_init,
+		.add		= tx2_uncore_aggr_event_add,
+		.del		= tx2_uncore_aggr_event_del,
+		.start		= tx2_uncore_aggr_event_start,
+		.stop		= tx2_uncore_aggr_event_stop,
+		.read		= tx2_uncore_aggr_event_read,
+	};
+
+	ret = perf_pmu_register(&tx2_aggr->pmu, tx2_pmu->type == PMU_TYPE_L3C ?
+			"uncore_l3c_all" : "uncore_dmc_all", -1);
+	if (ret)
+		dev_warn(tx2_pmu->dev, "Error %d registering aggregate PMU\n",
+				ret);
+	else
+		tx2_aggr->registered = true;
+}
+
+/*
+ * Unregister the aggregate PMU with the last PMU of its type. Called
+ * with tx2_pmu_cpu_lock held, after the PMU is off the tx2_pmus list.
+ */
+static void tx2_uncore_aggr_put(struct tx2_uncore_pmu *tx2_pmu)
+{
+	struct tx2_uncore_aggr *tx2_aggr = &tx2_aggrs[tx2_pmu->type];
+
+	if (--tx2_aggr->nr_pmus)
+		return;
+
+	if (tx2_aggr->registered)
+		perf_pmu_unregister(&tx2_aggr->pmu);
+	tx2_aggr->registered = false;
+	tx2_aggr->tx2_node = NULL;
+}
+
+/*
+ * Attach the PMU to its node, the node is allocated by its first PMU.
+ * Fails if the node has a PMU of the type already, e.g. an emulated one.
+ */
+static int tx2_uncore_node_get(struct tx2_uncore_pmu *tx2_pmu)
+{
+	struct tx2_uncore_node *tx2_node;
+
+	mutex_lock(&tx2_pmu_cpu_lock);
+	list_for_each_entry(tx2_node, &tx2_nodes, entry) {
+		if (tx2_node->node != tx2_pmu->node)
+			continue;
+		if (tx2_node->pmus[tx2_pmu->type]) {
+			mutex_unlock(&tx2_pmu_cpu_lock);
+			return -EBUSY;
+		}
+		goto found;
+	}
+
+	tx2_node = kzalloc(sizeof(*tx2_node), GFP_KERNEL);
+	if (!tx2_node) {
+		mutex_unlock(&tx2_pmu_cpu_lock);
+		return -ENOMEM;
 	}
+	tx2_node->node = tx2_pmu->node;
+	tx2_node->cpu = tx2_uncore_pick_cpu(tx2_node->node, -1);
+	tx2_node->hrtimer_interval = TX2_PMU_HRTIMER_INTERVAL;
+	hrtimer_init(&tx2_node->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	tx2_node->hrtimer.function = tx2_hrtimer_callback;
+	INIT_WORK(&tx2_node->work, tx2_uncore_node_work);
+	list_add(&tx2_node->entry, &tx2_nodes);
+found:
+	tx2_node->pmus[tx2_pmu->type] = tx2_pmu;
+	tx2_pmu->tx2_node = tx2_node;
+	mutex_unlock(&tx2_pmu_cpu_lock);
+	return 0;
 }
 
-static int tx2_uncore_event_add(struct perf_event *event, int flags)
+/* Detach the PMU from its node, the last PMU frees the node */
+static void tx2_uncore_node_put(struct tx2_uncore_pmu *tx2_pmu)
 {
-	struct hw_perf_event *hwc = &event->hw;
-	struct tx2_uncore_pmu *tx2_pmu;
+	struct tx2_uncore_node *tx2_node = tx2_pmu->tx2_node;
+	int i;
+
+	mutex_lock(&tx2_pmu_cpu_lock);
+	tx2_node->pmus[tx2_pmu->type] = NULL;
+	for (i = 0; i < PMU_TYPE_INVALID; i++) {
+		if (tx2_node->pmus[i])
+			goto out;
+	}
 
-	tx2_pmu = pmu_to_tx2_pmu(event->pmu);
+	tx2_uncore_node_cancel(tx2_node);
+	list_del(&tx2_node->entry);
+
+	/* Move the aggregate PMUs hosted by the node to another node */
+	for (i = 0; i < PMU_TYPE_INVALID; i++) {
+		struct tx2_uncore_aggr *tx2_aggr = &tx2_aggrs[i];
+		struct tx2_uncore_node *host;
+
+		if (!tx2_aggr->nr_pmus || tx2_aggr->tx2_node != tx2_node)
+			continue;
+		host = list_first_entry(&tx2_nodes, struct tx2_uncore_node,
+				entry);
+		if (tx2_aggr->registered &&
+		    tx2_node->cpu < nr_cpu_ids && host->cpu < nr_cpu_ids)
+			perf_pmu_migrate_context(&tx2_aggr->pmu,
+					tx2_node->cpu, host->cpu);
+		tx2_aggr->tx2_node = host;
+	}
+	kfree(tx2_node);
+out:
+	mutex_unlock(&tx2_pmu_cpu_lock);
+}
 
-	/* Allocate a free counter */
-	hwc->idx  = alloc_counter(tx2_pmu);
-	if (hwc->idx < 0)
-		return -EAGAIN;
+static void tx2_user_map_free(struct kref *ref)
+{
+	struct tx2_user_map *map = container_of(ref, struct tx2_user_map, ref);
 
-	tx2_pmu->events[hwc->idx] = event;
+	vfree(map->state);
+	kfree(map);
+}
 
-	hwc->state = PERF_HES_UPTODATE | PERF_HES_STOPPED;
-	if (flags & PERF_EF_START)
-		tx2_uncore_event_start(event, flags);
+/*
+ * The debugfs open proxy holds the file against removal while it opens
+ * it, and thereby the reference of the PMU to the map. A mapping holds
+ * its file open.
+ */
+static int tx2_user_map_open(struct inode *inode, struct file *file)
+{
+	struct tx2_user_map *map = inode->i_private;
 
+	kref_get(&map->ref);
+	file->private_data = map;
 	return 0;
 }
 
-static void tx2_uncore_event_del(struct perf_event *event, int flags)
+static int tx2_user_map_release(struct inode *inode, struct file *file)
 {
-	struct tx2_uncore_pmu *tx2_pmu = pmu_to_tx2_pmu(event->pmu);
-	struct hw_perf_event *hwc = &event->hw;
+	struct tx2_user_map *map = file->private_data;
 
-	tx2_uncore_event_stop(event, PERF_EF_UPDATE);
-
-	/* clear the assigned counter */
-	free_counter(tx2_pmu, GET_COUNTERID(event));
-
-	perf_event_update_userpage(event);
-	tx2_pmu->events[hwc->idx] = NULL;
-	hwc->idx = -1;
+	kref_put(&map->ref, tx2_user_map_free);
+	return 0;
 }
 
-static void tx2_uncore_event_read(struct perf_event *event)
+static int tx2_user_state_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	tx2_uncore_event_update(event);
-}
+	struct tx2_user_map *map = file->private_data;
 
-static enum hrtimer_restart tx2_hrtimer_callback(struct hrtimer *timer)
-{
-	struct tx2_uncore_pmu *tx2_pmu;
-	int max_counters, idx;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, map->state, vma->vm_pgoff);
+}
 
-	tx2_pmu = container_of(timer, struct tx2_uncore_pmu, hrtimer);
-	max_counters = tx2_pmu->max_counters;
+static const struct file_operations tx2_user_state_fops = {
+	.owner		= THIS_MODULE,
+	.open		= tx2_user_map_open,
+	.release	= tx2_user_map_release,
+	.mmap		= tx2_user_state_mmap,
+};
 
-	if (bitmap_empty(tx2_pmu->active_counters, max_counters))
-		return HRTIMER_NORESTART;
+static int tx2_user_regs_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct tx2_user_map *map = file->private_data;
 
-	for_each_set_bit(idx, tx2_pmu->active_counters, max_counters) {
-		struct perf_event *event = tx2_pmu->events[idx];
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	vma->vm_flags &= ~VM_MAYWRITE;
 
-		tx2_uncore_event_update(event);
-	}
-	hrtimer_forward_now(timer, ns_to_ktime(tx2_pmu->hrtimer_interval));
-	return HRTIMER_RESTART;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	return io_remap_pfn_range(vma, vma->vm_start,
+			map->chan_phys >> PAGE_SHIFT, PAGE_SIZE,
+			vma->vm_page_prot);
 }
 
-static int tx2_uncore_pmu_register(
-		struct tx2_uncore_pmu *tx2_pmu)
+static const struct file_operations tx2_user_regs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= tx2_user_map_open,
+	.release	= tx2_user_map_release,
+	.mmap		= tx2_user_regs_mmap,
+};
+
+/*
+ * <debugfs>/thunderx2_pmu/<pmu>/state and regs of an MMIO PMU, for user
+ * space to read its counters without system calls.
+ */
+static void tx2_uncore_pmu_debugfs_init(struct tx2_uncore_pmu *tx2_pmu)
 {
-	struct device *dev = tx2_pmu->dev;
-	char *name = tx2_pmu->name;
+	struct tx2_user_state *state;
+	struct tx2_user_map *map;
+	int idx;
 
-	/* Perf event registration */
-	tx2_pmu->pmu = (struct pmu) {
-		.module         = THIS_MODULE,
-		.attr_groups	= tx2_pmu->attr_groups,
-		.task_ctx_nr	= perf_invalid_context,
-		.event_init	= tx2_uncore_event_init,
-		.add		= tx2_uncore_event_add,
-		.del		= tx2_uncore_event_del,
-		.start		= tx2_uncore_event_start,
-		.stop		= tx2_uncore_event_stop,
-		.read		= tx2_uncore_event_read,
-	};
+	if (!tx2_pmu_debugfs ||
+	    tx2_pmu->ops->read_counter != uncore_read_counter_mmio)
+		return;
 
-	tx2_pmu->pmu.name = devm_kasprintf(dev, GFP_KERNEL,
-			"%s", name);
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return;
+	state = vmalloc_user(PAGE_SIZE);
+	if (!state) {
+		kfree(map);
+		return;
+	}
+	kref_init(&map->ref);
+	map->state = state;
+	map->chan_phys = tx2_pmu->chan_phys;
+
+	state->prorate = tx2_pmu->prorate_factor;
+	for (idx = 0; idx < tx2_pmu->max_counters; idx++)
+		state->counters[idx].reg = offset_in_page(tx2_pmu->chan_phys) +
+			tx2_pmu->cntr_data[idx];
+
+	/* the full proxy of debugfs_create_file() has no mmap */
+	tx2_pmu->debugfs = debugfs_create_dir(tx2_pmu->name, tx2_pmu_debugfs);
+	debugfs_create_file_unsafe("state", 0400, tx2_pmu->debugfs, map,
+			&tx2_user_state_fops);
+	debugfs_create_file_unsafe("regs", 0400, tx2_pmu->debugfs, map,
+			&tx2_user_regs_fops);
+	tx2_pmu->user_map = map;
+	tx2_pmu->user_state = state;
+}
 
-	return perf_pmu_register(&tx2_pmu->pmu, tx2_pmu->pmu.name, -1);
+/*
+ * Called once the PMU is unregistered, and its counters no more updated.
+ * The state is freed with the last open state or regs file.
+ */
+static void tx2_uncore_pmu_debugfs_exit(struct tx2_uncore_pmu *tx2_pmu)
+{
+	debugfs_remove_recursive(tx2_pmu->debugfs);
+	tx2_pmu->debugfs = NULL;
+	tx2_pmu->user_state = NULL;
+	if (tx2_pmu->user_map)
+		kref_put(&tx2_pmu->user_map->ref, tx2_user_map_free);
+	tx2_pmu->user_map = NULL;
 }
 
 static int tx2_uncore_pmu_add_dev(struct tx2_uncore_pmu *tx2_pmu)
 {
-	int ret, cpu;
-
-	cpu = cpumask_any_and(cpumask_of_node(tx2_pmu->node),
-			cpu_online_mask);
+	int ret;
 
-	tx2_pmu->cpu = cpu;
-	hrtimer_init(&tx2_pmu->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	tx2_pmu->hrtimer.function = tx2_hrtimer_callback;
+	ret = tx2_uncore_node_get(tx2_pmu);
+	if (ret)
+		return ret;
 
+	tx2_uncore_pmu_debugfs_init(tx2_pmu);
 	ret = tx2_uncore_pmu_register(tx2_pmu);
 	if (ret) {
 		dev_err(tx2_pmu->dev, "%s PMU: Failed to init driver\n",
 				tx2_pmu->name);
+		tx2_uncore_pmu_debugfs_exit(tx2_pmu);
+		tx2_uncore_node_put(tx2_pmu);
 		return -ENODEV;
 	}
 
+#ifdef TX2_PMU_HOTPLUG
+	/* register hotplug callback for the pmu */
+	ret = cpuhp_state_add_instance(tx2_uncore_cpuhp_state,
+			&tx2_pmu->hpnode);
 	if (ret) {
 		dev_err(tx2_pmu->dev, "Error %d registering hotplug", ret);
+		tx2_uncore_pmu_unregister(tx2_pmu);
+		tx2_uncore_pmu_debugfs_exit(tx2_pmu);
+		tx2_uncore_node_put(tx2_pmu);
 		return ret;
 	}
+#endif
 
 	/* Add to list */
+	mutex_lock(&tx2_pmu_cpu_lock);
 	list_add(&tx2_pmu->entry, &tx2_pmus);
+	tx2_uncore_aggr_get(tx2_pmu);
+	tx2_uncore_attrib_get(tx2_pmu);
+	mutex_unlock(&tx2_pmu_cpu_lock);
 
 	dev_dbg(tx2_pmu->dev, "%s PMU UNCORE registered\n",
 			tx2_pmu->pmu.name);
 	return ret;
 }
 
-static struct tx2_uncore_pmu *tx2_uncore_pmu_init_dev(struct device *dev,
-		acpi_handle handle, struct acpi_device *adev, u32 type)
+/* Memory resources of a PMU device, in _CRS order */
+struct tx2_uncore_res {
+	struct resource res[TX2_PMU_L3_TILES];
+	int nr_res;
+};
+
+/* The PMUs of the socket of a platform device, allocated at once */
+struct tx2_uncore_probe_ctx {
+	struct device *dev;
+	struct tx2_uncore_pmu *pmus;
+};
+
+static acpi_status tx2_uncore_pmu_add_res(struct acpi_resource *ares,
+		void *data)
 {
-	struct tx2_uncore_pmu *tx2_pmu;
-	void __iomem *base;
-	struct resource res;
-	struct resource_entry *rentry;
-	struct list_head list;
-	int ret;
+	struct tx2_uncore_res *r = data;
+	struct resource_win win;
 
-	INIT_LIST_HEAD(&list);
-	ret = acpi_dev_get_resources(adev, &list, NULL, NULL);
-	if (ret <= 0) {
-		dev_err(dev, "failed to parse _CRS method, error %d\n", ret);
-		return NULL;
+	if (r->nr_res == TX2_PMU_L3_TILES)
+		return AE_OK;
+
+	if (acpi_dev_resource_memory(ares, &r->res[r->nr_res])) {
+		r->nr_res++;
+	} else if (acpi_dev_resource_address_space(ares, &win) &&
+		   resource_type(&win.res) == IORESOURCE_MEM) {
+		r->res[r->nr_res++] = win.res;
 	}
+	return AE_OK;
+}
 
-	list_for_each_entry(rentry, &list, node) {
-		if (resource_type(rentry->res) == IORESOURCE_MEM) {
-			res = *rentry->res;
-			break;
-		}
+/*
+ * Channels/tiles of an MMIO PMU. The firmware describes either one register
+ * window per channel, or a single window the channels are muxed behind,
+ * selected with an SMC call. Without that call only channel 0 is counted.
+ */
+static void tx2_uncore_init_chans(struct tx2_uncore_pmu *tx2_pmu, int nr_res)
+{
+	struct arm_smccc_res res;
+	int chan;
+
+	if (nr_res > 1) {
+		tx2_pmu->nr_chans = min_t(u32, nr_res, tx2_pmu->max_chans);
+		return;
 	}
 
-	if (!rentry->res)
-		return NULL;
+	tx2_pmu_smc(tx2_pmu, TX2_SMC_SELECT, SELECT_CHANNEL, 0, tx2_pmu->type,
+			&res);
+	if (res.a0) {
+		dev_info(tx2_pmu->dev,
+			"%s: no channel select, counting channel 0 only\n",
+				tx2_pmu->name);
+		return;
+	}
+
+	tx2_pmu->chan_mux = true;
+	tx2_pmu->nr_chans = tx2_pmu->max_chans;
+	for (chan = 1; chan < tx2_pmu->max_chans; chan++)
+		tx2_pmu->chan_base[chan] = tx2_pmu->chan_base[0];
+}
+
+static struct tx2_uncore_pmu *tx2_uncore_pmu_init_dev(struct device *dev,
+		acpi_handle handle, struct tx2_uncore_pmu *pmus, u32 type)
+{
+	struct tx2_uncore_pmu *tx2_pmu = &pmus[type];
+	struct tx2_uncore_res r;
+	acpi_status status;
+	int i, nr_res;
 
-	acpi_dev_free_resource_list(&list);
-	base = devm_ioremap_resource(dev, &res);
-	if (IS_ERR(base)) {
-		dev_err(dev, "PMU type %d: Fail to map resource\n", type);
+	if (tx2_pmu->dev) {
+		dev_err(dev, "PMU type %d: duplicate device\n", type);
 		return NULL;
 	}
 
-	tx2_pmu = devm_kzalloc(dev, sizeof(*tx2_pmu), GFP_KERNEL);
-	if (!tx2_pmu)
-		return NULL;
+	/* Register windows of the channels/tiles, channel 0 first */
+	r.nr_res = 0;
+	if (handle) {
+		status = acpi_walk_resources(handle, METHOD_NAME__CRS,
+				tx2_uncore_pmu_add_res, &r);
+		if (ACPI_FAILURE(status)) {
+			dev_err(dev, "failed to parse _CRS method, error %d\n",
+					status);
+			return NULL;
+		}
+		if (!r.nr_res)
+			return NULL;
+	}
+	nr_res = r.nr_res;
+
+	if (nr_res)
+		tx2_pmu->chan_phys = r.res[0].start;
+	for (i = 0; i < nr_res; i++) {
+		tx2_pmu->chan_base[i] = devm_ioremap_resource(dev, &r.res[i]);
+		if (IS_ERR(tx2_pmu->chan_base[i])) {
+			dev_err(dev, "PMU type %d: Fail to map resource\n",
+					type);
+			return NULL;
+		}
+	}
 
 	tx2_pmu->dev = dev;
 	tx2_pmu->type = type;
-	tx2_pmu->base = base;
 	tx2_pmu->node = dev_to_node(dev);
+	tx2_pmu->prorate_factor = 1;
+	tx2_pmu->nr_chans = 1;
+	/* without an ACPI device, the PMUs are emulated */
+	tx2_pmu->ops = handle ? &tx2_smc_ops : &tx2_emul_ops;
 	INIT_LIST_HEAD(&tx2_pmu->entry);
+	raw_spin_lock_init(&tx2_pmu->lock);
+	raw_spin_lock_init(&tx2_pmu->attrib_lock);
 
 	switch (tx2_pmu->type) {
 	case PMU_TYPE_L3C:
 		tx2_pmu->max_counters = TX2_PMU_MAX_COUNTERS;
 		tx2_pmu->max_events = L3_EVENT_MAX;
-		tx2_pmu->hrtimer_interval = TX2_PMU_HRTIMER_INTERVAL;
+		tx2_pmu->max_metrics = L3_METRIC_MAX;
+		tx2_pmu->clock_hz = TX2_PMU_L3C_CLOCK_MAX_HZ;
+		tx2_pmu->metrics = l3c_metrics;
+		tx2_pmu->max_chans = TX2_PMU_L3_TILES;
+		tx2_pmu->hrtimer_interval_min = TX2_PMU_HRTIMER_INTERVAL_MIN;
+		tx2_pmu->hrtimer_interval_max = TX2_PMU_HRTIMER_INTERVAL;
 		tx2_pmu->attr_groups = l3c_pmu_attr_groups;
 		tx2_pmu->name = devm_kasprintf(dev, GFP_KERNEL,
 				"uncore_l3c_%d", tx2_pmu->node);
+		if (l3c_mmio && handle) {
+			tx2_pmu->prorate_factor = TX2_PMU_L3_TILES;
+			tx2_uncore_init_chans(tx2_pmu, nr_res);
+			init_cntr_base_l3c(tx2_pmu);
+			tx2_pmu->ops = &tx2_l3c_mmio_ops;
+		}
 		break;
 	case PMU_TYPE_DMC:
 		tx2_pmu->max_counters = TX2_PMU_MAX_COUNTERS;
 		tx2_pmu->max_events = DMC_EVENT_MAX;
-		tx2_pmu->hrtimer_interval = TX2_PMU_HRTIMER_INTERVAL;
+		tx2_pmu->max_metrics = DMC_METRIC_MAX;
+		tx2_pmu->clock_hz = TX2_PMU_DMC_CLOCK_MAX_HZ;
+		tx2_pmu->metrics = dmc_metrics;
+		tx2_pmu->max_chans = TX2_PMU_DMC_CHANNELS;
+		tx2_pmu->hrtimer_interval_min = TX2_PMU_HRTIMER_INTERVAL_MIN;
+		tx2_pmu->hrtimer_interval_max = TX2_PMU_HRTIMER_INTERVAL;
 		tx2_pmu->attr_groups = dmc_pmu_attr_groups;
 		tx2_pmu->name = devm_kasprintf(dev, GFP_KERNEL,
 				"uncore_dmc_%d", tx2_pmu->node);
+		if (dmc_mmio && handle) {
+			tx2_pmu->prorate_factor = TX2_PMU_DMC_CHANNELS;
+			tx2_uncore_init_chans(tx2_pmu, nr_res);
+			init_cntr_base_dmc(tx2_pmu);
+			tx2_pmu->ops = &tx2_dmc_mmio_ops;
+		}
 		break;
 	case PMU_TYPE_INVALID:
-		devm_kfree(dev, tx2_pmu);
 		return NULL;
 	}
 
+	/* Batched read is an SMC call, not needed for MMIO access */
+	if (tx2_pmu->ops == &tx2_smc_ops) {
+		tx2_pmu->batch_read = tx2_pmu_probe_batch_read(tx2_pmu);
+		if (!tx2_pmu_startstop_counters(tx2_pmu, 0, NULL))
+			tx2_pmu->ops = &tx2_smc_batch_ops;
+	}
+
 	return tx2_pmu;
 }
 
 static acpi_status tx2_uncore_pmu_add(acpi_handle handle, u32 level,
 				    void *data, void **return_value)
 {
+	struct tx2_uncore_probe_ctx *ctx = data;
 	struct tx2_uncore_pmu *tx2_pmu;
 	struct acpi_device *adev;
 	enum tx2_uncore_type type;
@@ -685,8 +3723,7 @@ static acpi_status tx2_uncore_pmu_add(acpi_handle handle, u32 level,
 	if (type == PMU_TYPE_INVALID)
 		return AE_OK;
 
-	tx2_pmu = tx2_uncore_pmu_init_dev((struct device *)data,
-			handle, adev, type);
+	tx2_pmu = tx2_uncore_pmu_init_dev(ctx->dev, handle, ctx->pmus, type);
 
 	if (!tx2_pmu)
 		return AE_ERROR;
@@ -704,27 +3741,100 @@ static const struct acpi_device_id tx2_uncore_acpi_match[] = {
 };
 MODULE_DEVICE_TABLE(acpi, tx2_uncore_acpi_match);
 
+/* Unregister the PMUs of the platform device @dev */
+static void tx2_uncore_remove_pmus(struct device *dev)
+{
+	struct tx2_uncore_pmu *tx2_pmu, *temp;
+	LIST_HEAD(pmus);
+
+	mutex_lock(&tx2_pmu_cpu_lock);
+	list_for_each_entry_safe(tx2_pmu, temp, &tx2_pmus, entry) {
+		if (tx2_pmu->dev == dev) {
+			list_move(&tx2_pmu->entry, &pmus);
+			tx2_uncore_attrib_put(tx2_pmu);
+			tx2_uncore_aggr_put(tx2_pmu);
+		}
+	}
+	mutex_unlock(&tx2_pmu_cpu_lock);
+
+	list_for_each_entry_safe(tx2_pmu, temp, &pmus, entry) {
+#ifdef TX2_PMU_HOTPLUG
+		cpuhp_state_remove_instance_nocalls(tx2_uncore_cpuhp_state,
+				&tx2_pmu->hpnode);
+#endif
+		tx2_uncore_pmu_unregister(tx2_pmu);
+		tx2_uncore_pmu_debugfs_exit(tx2_pmu);
+		tx2_uncore_node_put(tx2_pmu);
+		list_del(&tx2_pmu->entry);
+	}
+}
+
+/*
+ * Emulated PMUs of the socket of node @pdev->id, see tx2_uncore_emul_init.
+ * A device type the node has a PMU of, described by ACPI, is not emulated.
+ */
+static int tx2_uncore_emul_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	struct tx2_uncore_pmu *pmus, *tx2_pmu;
+	int ret, type, nr = 0;
+
+	set_dev_node(dev, pdev->id);
+	pmus = devm_kcalloc(dev, PMU_TYPE_INVALID, sizeof(*pmus), GFP_KERNEL);
+	if (!pmus)
+		return -ENOMEM;
+
+	for (type = 0; type < PMU_TYPE_INVALID; type++) {
+		tx2_pmu = tx2_uncore_pmu_init_dev(dev, NULL, pmus, type);
+		ret = tx2_pmu ? tx2_uncore_pmu_add_dev(tx2_pmu) : -ENODEV;
+		if (ret == -EBUSY) {
+			dev_info(dev, "node%d: %s present, not emulated\n",
+					pdev->id, tx2_pmu->name);
+			continue;
+		}
+		if (ret) {
+			tx2_uncore_remove_pmus(dev);
+			return -ENODEV;
+		}
+		nr++;
+	}
+	if (!nr)
+		return -ENODEV;
+
+	dev_info(dev, "node%d: emulated pmu uncore registered\n", pdev->id);
+	return 0;
+}
+
 static int tx2_uncore_probe(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
+	struct tx2_uncore_probe_ctx ctx;
 	acpi_handle handle;
 	acpi_status status;
 
-	set_dev_node(dev, acpi_get_node(ACPI_HANDLE(dev)));
-
+	/* only the emulated devices are matched by name */
 	if (!has_acpi_companion(dev))
-		return -ENODEV;
+		return tx2_uncore_emul_probe(pdev);
+
+	set_dev_node(dev, acpi_get_node(ACPI_HANDLE(dev)));
 
 	handle = ACPI_HANDLE(dev);
 	if (!handle)
 		return -EINVAL;
 
+	ctx.dev = dev;
+	ctx.pmus = devm_kcalloc(dev, PMU_TYPE_INVALID, sizeof(*ctx.pmus),
+			GFP_KERNEL);
+	if (!ctx.pmus)
+		return -ENOMEM;
+
 	/* Walk through the tree for all PMU UNCORE devices */
 	status = acpi_walk_namespace(ACPI_TYPE_DEVICE, handle, 1,
 				     tx2_uncore_pmu_add,
-				     NULL, dev, NULL);
+				     NULL, &ctx, NULL);
 	if (ACPI_FAILURE(status)) {
 		dev_err(dev, "failed to probe PMU devices\n");
+		tx2_uncore_remove_pmus(dev);
 		return_ACPI_STATUS(status);
 	}
 
@@ -734,17 +3844,7 @@ static int tx2_uncore_probe(struct platform_device *pdev)
 
 static int tx2_uncore_remove(struct platform_device *pdev)
 {
-	struct tx2_uncore_pmu *tx2_pmu, *temp;
-	struct device *dev = &pdev->dev;
-
-	if (!list_empty(&tx2_pmus)) {
-		list_for_each_entry_safe(tx2_pmu, temp, &tx2_pmus, entry) {
-			if (tx2_pmu->node == dev_to_node(dev)) {
-				perf_pmu_unregister(&tx2_pmu->pmu);
-				list_del(&tx2_pmu->entry);
-			}
-		}
-	}
+	tx2_uncore_remove_pmus(&pdev->dev);
 	return 0;
 }
 
@@ -752,23 +3852,343 @@ static struct platform_driver tx2_uncore_driver = {
 	.driver = {
 		.name		= "tx2-uncore-pmu",
 		.acpi_match_table = ACPI_PTR(tx2_uncore_acpi_match),
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+		/* the sockets are independent, probe them in parallel */
+		.probe_type	= PROBE_PREFER_ASYNCHRONOUS,
+#endif
 	},
 	.probe = tx2_uncore_probe,
 	.remove = tx2_uncore_remove,
 };
 
+static struct platform_device *tx2_emul_devs[MAX_NUMNODES];
+
+static void tx2_uncore_emul_exit(void)
+{
+	int node;
+
+	for (node = 0; node < MAX_NUMNODES; node++) {
+		if (tx2_emul_devs[node])
+			platform_device_unregister(tx2_emul_devs[node]);
+		tx2_emul_devs[node] = NULL;
+	}
+}
+
+/*
+ * Emulated sockets are platform devices named after the driver, with the
+ * node as id. They bind to the driver as ACPI enumerated devices are
+ * named after their ACPI id.
+ */
+static int tx2_uncore_emul_init(void)
+{
+	struct platform_device *pdev;
+	unsigned int nr = 0;
+	int node;
+
+	if (!emulate)
+		return 0;
+
+	/* the devices described by ACPI, probed asynchronously, come first */
+	wait_for_device_probe();
+	for_each_online_node(node) {
+		if (nr++ == emulate)
+			break;
+		pdev = platform_device_register_simple(
+				tx2_uncore_driver.driver.name, node, NULL, 0);
+		if (IS_ERR(pdev)) {
+			tx2_uncore_emul_exit();
+			return PTR_ERR(pdev);
+		}
+		tx2_emul_devs[node] = pdev;
+	}
+	return 0;
+}
+
+#ifdef TX2_PMU_HOTPLUG
+static int tx2_uncore_pmu_online_cpu(unsigned int cpu,
+		struct hlist_node *hpnode)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+
+	tx2_pmu = hlist_entry_safe(hpnode,
+			struct tx2_uncore_pmu, hpnode);
+
+	/* Pick this CPU, If there is no CPU/PMU association and both are
+	 * from same node.
+	 */
+	mutex_lock(&tx2_pmu_cpu_lock);
+	if ((tx2_pmu->tx2_node->cpu >= nr_cpu_ids) &&
+		(tx2_pmu->node == cpu_to_node(cpu)))
+		tx2_pmu->tx2_node->cpu = cpu;
+	mutex_unlock(&tx2_pmu_cpu_lock);
+
+	return 0;
+}
+
+static int tx2_uncore_pmu_offline_cpu(unsigned int cpu,
+		struct hlist_node *hpnode)
+{
+	struct tx2_uncore_pmu *tx2_pmu;
+
+	tx2_pmu = hlist_entry_safe(hpnode,
+			struct tx2_uncore_pmu, hpnode);
+
+	/*
+	 * Move the node to another online CPU of the node, if there is one.
+	 * The first PMU of the node to get here moves all of them.
+	 */
+	mutex_lock(&tx2_pmu_cpu_lock);
+	if (cpu == tx2_pmu->tx2_node->cpu)
+		tx2_uncore_node_migrate(tx2_pmu->tx2_node,
+				tx2_uncore_pick_cpu(tx2_pmu->node, cpu));
+	mutex_unlock(&tx2_pmu_cpu_lock);
+
+	return 0;
+}
+#endif
+
+/*
+ * The ring is freed at module exit, a mapping holds its file open, and
+ * thereby the module through the fops owner.
+ */
+static int tx2_snapshot_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, tx2_snapshot_ring, vma->vm_pgoff);
+}
+
+static const struct file_operations tx2_snapshot_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.mmap		= tx2_snapshot_mmap,
+	.llseek		= noop_llseek,
+};
+
+static void tx2_stat_show(struct seq_file *m, const char *name,
+		const struct tx2_uncore_stat *stat)
+{
+	int i;
+
+	seq_printf(m, "  %-18s calls %llu failures %llu avg_ns %llu max_ns %llu\n",
+		   name, stat->calls, stat->failures,
+		   stat->calls ? div64_u64(stat->total_ns, stat->calls) : 0,
+		   stat->max_ns);
+	for (i = 0; i < TX2_STAT_BUCKETS; i++) {
+		if (!stat->hist[i])
+			continue;
+		if (i < TX2_STAT_BUCKETS - 1)
+			seq_printf(m, "    < %llu ns: %llu\n", 256ULL << i,
+				   stat->hist[i]);
+		else
+			seq_printf(m, "    >= %llu ns: %llu\n", 128ULL << i,
+				   stat->hist[i]);
+	}
+}
+
+/* Attribution sources, their traffic while no CPU ran an attribution event */
+static void tx2_attrib_stats_show(struct seq_file *m,
+		struct tx2_uncore_pmu *tx2_pmu)
+{
+	struct perf_event *event;
+	int i;
+
+	for (i = 0; i < TX2_ATTRIB_EVENTS; i++) {
+		event = tx2_pmu->attrib_src[i];
+		if (!event)
+			continue;
+		seq_printf(m, "  attrib %#x users %d unshared %llu%s\n",
+			   dmc_attrib_events[i], tx2_pmu->attrib_users[i],
+			   tx2_pmu->attrib_unshared[i],
+			   READ_ONCE(event->state) == PERF_EVENT_STATE_ACTIVE ?
+			   "" : " (source not counting)");
+	}
+}
+
+/* The counters are read without synchronization, they may be torn */
+static int tx2_stats_show(struct seq_file *m, void *v)
+{
+	struct tx2_uncore_node *tx2_node;
+	struct tx2_uncore_pmu *tx2_pmu;
+	int i, j;
+
+	mutex_lock(&tx2_pmu_cpu_lock);
+	list_for_each_entry(tx2_node, &tx2_nodes, entry) {
+		seq_printf(m, "node %d cpu %d timer_overruns %llu\n",
+			   tx2_node->node, tx2_node->cpu,
+			   tx2_node->timer_overruns);
+		tx2_stat_show(m, "sample", &tx2_node->sample_stat);
+		tx2_stat_show(m, "timer_latency", &tx2_node->timer_latency);
+		for (i = 0; i < PMU_TYPE_INVALID; i++) {
+			tx2_pmu = tx2_node->pmus[i];
+			if (!tx2_pmu)
+				continue;
+			seq_printf(m, " %s batch_read %d failed_counters %#lx\n",
+				   tx2_pmu->name, tx2_pmu->batch_read,
+				   *tx2_pmu->failed_counters);
+			for (j = 0; j < TX2_SMC_STATS; j++) {
+				if (tx2_pmu->smc_stats[j].calls)
+					tx2_stat_show(m, tx2_smc_stat_names[j],
+						&tx2_pmu->smc_stats[j]);
+			}
+			tx2_attrib_stats_show(m, tx2_pmu);
+		}
+	}
+	mutex_unlock(&tx2_pmu_cpu_lock);
+	return 0;
+}
+
+static int tx2_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tx2_stats_show, inode->i_private);
+}
+
+static const struct file_operations tx2_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= tx2_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int tx2_hist_show(struct seq_file *m, void *v)
+{
+	struct tx2_hist_state *hist;
+	int i;
+
+	mutex_lock(&tx2_hist_lock);
+	list_for_each_entry(hist, &tx2_hist_events, entry) {
+		seq_printf(m, "%s config %#llx intervals %llu max_rate %llu\n",
+			   hist->event->pmu->name, hist->event->attr.config,
+			   hist->intervals, hist->max_rate);
+		for (i = 0; i < TX2_HIST_BUCKETS; i++) {
+			if (hist->hist[i])
+				seq_printf(m, "  %llu-%llu/s: %llu\n",
+					   i ? 1ULL << (i - 1) : 0,
+					   i ? (1ULL << i) - 1 : 0,
+					   hist->hist[i]);
+		}
+	}
+	mutex_unlock(&tx2_hist_lock);
+	return 0;
+}
+
+static int tx2_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tx2_hist_show, inode->i_private);
+}
+
+static const struct file_operations tx2_hist_fops = {
+	.owner		= THIS_MODULE,
+	.open		= tx2_hist_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void tx2_uncore_debugfs_init(void)
+{
+	struct tx2_snapshot_ring *ring;
+
+	tx2_pmu_debugfs = debugfs_create_dir("thunderx2_pmu", NULL);
+	debugfs_create_file("stats", 0400, tx2_pmu_debugfs, NULL,
+			&tx2_stats_fops);
+	debugfs_create_file("histograms", 0400, tx2_pmu_debugfs, NULL,
+			&tx2_hist_fops);
+
+	if (!snapshot_entries)
+		return;
+
+	ring = vmalloc_user(sizeof(*ring) +
+			snapshot_entries * sizeof(ring->entries[0]));
+	if (!ring) {
+		pr_warn("TX2 PMU: failed to allocate the snapshot ring\n");
+		return;
+	}
+	ring->version = TX2_SNAPSHOT_VERSION;
+	ring->nr_entries = snapshot_entries;
+	tx2_snapshot_ring = ring;
+
+	/* the full proxy of debugfs_create_file() has no mmap */
+	debugfs_create_file_unsafe("snapshots", 0400, tx2_pmu_debugfs, NULL,
+			&tx2_snapshot_fops);
+}
+
+static void tx2_uncore_debugfs_exit(void)
+{
+	debugfs_remove_recursive(tx2_pmu_debugfs);
+	vfree(tx2_snapshot_ring);
+	tx2_snapshot_ring = NULL;
+}
+
 static int __init tx2_uncore_driver_init(void)
 {
 	int ret;
 
+#ifdef TX2_PMU_USERPAGE_LOOKUP
+	tx2_perf_event_update_userpage = (void *)kallsyms_lookup_name(
+			"perf_event_update_userpage");
+#endif
+
+	if (housekeeping_cpus) {
+		ret = cpulist_parse(housekeeping_cpus, &tx2_housekeeping_mask);
+		if (ret) {
+			pr_err("TX2 PMU: invalid housekeeping_cpus(%d)\n", ret);
+			return ret;
+		}
+	}
+
+#ifdef TX2_PMU_HOTPLUG
+	ret = cpuhp_setup_state_multi(CPUHP_AP_ONLINE_DYN,
+				      "perf/tx2/uncore:online",
+				      tx2_uncore_pmu_online_cpu,
+				      tx2_uncore_pmu_offline_cpu);
+	if (ret < 0) {
+		pr_err("TX2 PMU: setup hotplug failed(%d)\n", ret);
+		return ret;
+	}
+	tx2_uncore_cpuhp_state = ret;
+#endif
+
+	ret = tx2_uncore_events_init();
+	if (ret) {
+#ifdef TX2_PMU_HOTPLUG
+		cpuhp_remove_multi_state(tx2_uncore_cpuhp_state);
+#endif
+		return ret;
+	}
+
+	tx2_uncore_debugfs_init();
+
 	ret = platform_driver_register(&tx2_uncore_driver);
+	if (!ret) {
+		ret = tx2_uncore_emul_init();
+		if (ret)
+			platform_driver_unregister(&tx2_uncore_driver);
+	}
+	if (ret) {
+		tx2_uncore_debugfs_exit();
+		tx2_uncore_events_exit();
+#ifdef TX2_PMU_HOTPLUG
+		cpuhp_remove_multi_state(tx2_uncore_cpuhp_state);
+#endif
+	}
+
 	return ret;
 }
 module_init(tx2_uncore_driver_init);
 
 static void __exit tx2_uncore_driver_exit(void)
 {
+	tx2_uncore_emul_exit();
 	platform_driver_unregister(&tx2_uncore_driver);
+	tx2_uncore_debugfs_exit();
+	tx2_uncore_events_exit();
+#ifdef TX2_PMU_HOTPLUG
+	cpuhp_remove_multi_state(tx2_uncore_cpuhp_state);
+#endif
 }
 module_exit(tx2_uncore_driver_exit);
 
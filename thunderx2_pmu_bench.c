@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * CAVIUM THUNDERX2 SoC PMU UNCORE read benchmark
+ *
+ * Counts an event on each of the given uncore PMUs and reads it with
+ * perf_event_read_value() from the first CPU of every node, reporting the
+ * read rate and latency percentiles in the kernel log. The driver reads
+ * the counters through SMC calls or MMIO as loaded, the sampling timer
+ * cost is reported by <debugfs>/thunderx2_pmu/stats.
+ *
+ * insmod thunderx2_pmu_bench.ko types=<perf type>[,...] [config=] [reads=]
+ *
+ * The module only runs at init, which fails with -EAGAIN once the results
+ * are reported so that it is not left loaded.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/nodemask.h>
+#include <linux/perf_event.h>
+#include <linux/sort.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+/* array_size() saturates on overflow, from 4.18 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0)
+#include <linux/overflow.h>
+#else
+#define array_size(n, size)						\
+	((n) > SIZE_MAX / (size) ? SIZE_MAX : (size_t)(n) * (size))
+#endif
+
+#define TX2_BENCH_MAX_PMUS	16
+
+static int types[TX2_BENCH_MAX_PMUS];
+static int nr_types;
+module_param_array(types, int, &nr_types, 0444);
+MODULE_PARM_DESC(types, "perf types of the PMUs to benchmark, from sysfs");
+
+static unsigned long config = 0xd;
+module_param(config, ulong, 0444);
+MODULE_PARM_DESC(config, "Event counted on every PMU (default read_request/data_transfers)");
+
+static unsigned int reads = 10000;
+module_param(reads, uint, 0444);
+MODULE_PARM_DESC(reads, "Reads per PMU and node");
+
+struct tx2_bench {
+	struct perf_event *event;
+	u64 *lat;
+	u64 total_ns;
+	u64 count;
+};
+
+static int tx2_bench_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Runs on the CPU reading the event */
+static long tx2_bench_run(void *arg)
+{
+	struct tx2_bench *bench = arg;
+	u64 enabled, running, start, t;
+	unsigned int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < reads; i++) {
+		t = ktime_get_ns();
+		bench->count = perf_event_read_value(bench->event,
+				&enabled, &running);
+		bench->lat[i] = ktime_get_ns() - t;
+	}
+	bench->total_ns = ktime_get_ns() - start;
+	return 0;
+}
+
+static void tx2_bench_pmu(int type)
+{
+	struct perf_event_attr attr = {
+		.type		= type,
+		.size		= sizeof(attr),
+		.config		= config,
+	};
+	struct tx2_bench bench;
+	int node, cpu;
+
+	bench.event = perf_event_create_kernel_counter(&attr,
+			cpumask_first(cpu_online_mask), NULL, NULL, NULL);
+	if (IS_ERR(bench.event)) {
+		pr_err("type %d: failed to create event, error %ld\n",
+				type, PTR_ERR(bench.event));
+		return;
+	}
+
+	bench.lat = vmalloc(array_size(reads, sizeof(*bench.lat)));
+	if (!bench.lat)
+		goto out;
+
+	for_each_online_node(node) {
+		cpu = cpumask_first_and(cpumask_of_node(node), cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			continue;
+
+		work_on_cpu(cpu, tx2_bench_run, &bench);
+		sort(bench.lat, reads, sizeof(*bench.lat), tx2_bench_cmp, NULL);
+		pr_info("type %d node %d cpu %d (event cpu %d): %llu reads/s, p50 %llu ns, p99 %llu ns, max %llu ns, count %llu\n",
+			type, node, cpu, bench.event->cpu,
+			div64_u64((u64)reads * NSEC_PER_SEC,
+				  max_t(u64, bench.total_ns, 1)),
+			bench.lat[reads / 2], bench.lat[reads * 99ULL / 100],
+			bench.lat[reads - 1], bench.count);
+	}
+
+	vfree(bench.lat);
+out:
+	perf_event_release_kernel(bench.event);
+}
+
+static int __init tx2_bench_init(void)
+{
+	int i;
+
+	if (!nr_types || !reads)
+		return -EINVAL;
+
+	for (i = 0; i < nr_types; i++)
+		tx2_bench_pmu(types[i]);
+
+	/* nothing is left to do, do not stay loaded */
+	return -EAGAIN;
+}
+module_init(tx2_bench_init);
+
+static void __exit tx2_bench_exit(void)
+{
+}
+module_exit(tx2_bench_exit);
+
+MODULE_DESCRIPTION("ThunderX2 UNCORE PMU read benchmark");
+MODULE_LICENSE("GPL v2");
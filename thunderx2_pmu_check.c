@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * CAVIUM THUNDERX2 SoC PMU UNCORE user space mapping check
+ *
+ * Maps <debugfs>/thunderx2_pmu/snapshots read-only, checks that it can not
+ * be mapped or made writable, and prints the latest entries of the ring.
+ * Likewise maps the state and regs of every MMIO PMU, and prints the
+ * current counts of its active counters.
+ *
+ * thunderx2_pmu_check [debugfs dir, default /sys/kernel/debug/thunderx2_pmu]
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TX2_PMU_MAX_COUNTERS	4
+#define TX2_SNAPSHOT_VERSION	1
+#define GET_SCOPE(config)	(((config) >> 12) & 0x3)
+
+/* Layout of the driver, see thunderx2-pmu.txt */
+struct tx2_snapshot_entry {
+	uint32_t seq;
+	uint16_t node;
+	uint8_t type;
+	uint8_t counters;
+	uint64_t time;
+	uint32_t config[TX2_PMU_MAX_COUNTERS];
+	uint64_t count[TX2_PMU_MAX_COUNTERS];
+};
+
+struct tx2_snapshot_ring {
+	uint32_t version;
+	uint32_t nr_entries;
+	uint64_t head;
+	uint64_t reserved[6];
+	struct tx2_snapshot_entry entries[];
+};
+
+struct tx2_user_counter {
+	uint32_t active;
+	uint32_t config;
+	uint32_t reg;
+	uint32_t raw;
+	uint64_t count;
+};
+
+struct tx2_user_state {
+	uint32_t seq;
+	uint32_t prorate;
+	struct tx2_user_counter counters[TX2_PMU_MAX_COUNTERS];
+};
+
+#define READ_ONCE(x)	(*(volatile typeof(x) *)&(x))
+#define rmb()		__atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+static int failures;
+
+static void check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	failures += !ok;
+}
+
+/* A mapping of @fd must be read-only, and stay so */
+static void check_readonly(int fd, size_t len, const char *name)
+{
+	char what[256];
+	void *p;
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	snprintf(what, sizeof(what), "%s: writable mapping refused", name);
+	check(p == MAP_FAILED, what);
+	if (p != MAP_FAILED)
+		munmap(p, len);
+
+	p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return;
+	snprintf(what, sizeof(what), "%s: mprotect(PROT_WRITE) refused", name);
+	check(mprotect(p, len, PROT_READ | PROT_WRITE) == -1, what);
+	munmap(p, len);
+}
+
+/* Copy entry @slot, retrying while it is being written */
+static void read_entry(const struct tx2_snapshot_ring *ring, uint64_t slot,
+		struct tx2_snapshot_entry *entry)
+{
+	const struct tx2_snapshot_entry *e = &ring->entries[slot];
+	uint32_t seq;
+
+	do {
+		seq = READ_ONCE(e->seq);
+		rmb();
+		memcpy(entry, e, sizeof(*entry));
+		rmb();
+	} while ((seq & 1) || seq != READ_ONCE(e->seq));
+}
+
+static void check_snapshots(const char *dir)
+{
+	const struct tx2_snapshot_ring *ring;
+	struct tx2_snapshot_entry entry;
+	char path[256];
+	uint64_t head, i;
+	size_t len;
+	int fd, idx;
+
+	snprintf(path, sizeof(path), "%s/snapshots", dir);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("skip: %s: %s (load with snapshot_entries=N)\n", path,
+		       strerror(errno));
+		return;
+	}
+
+	/* the header tells the size of the ring */
+	ring = mmap(NULL, sizeof(*ring), PROT_READ, MAP_SHARED, fd, 0);
+	check(ring != MAP_FAILED, "snapshots: read-only mapping");
+	if (ring == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+	check(ring->version == TX2_SNAPSHOT_VERSION && ring->nr_entries,
+	      "snapshots: version and nr_entries");
+	len = sizeof(*ring) + ring->nr_entries * sizeof(ring->entries[0]);
+	munmap((void *)ring, sizeof(*ring));
+
+	ring = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	check(ring != MAP_FAILED, "snapshots: mapping of the whole ring");
+	if (ring == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+	check_readonly(fd, len, "snapshots");
+
+	head = READ_ONCE(ring->head);
+	rmb();
+	printf("snapshots: nr_entries %u head %llu\n", ring->nr_entries,
+	       (unsigned long long)head);
+	for (i = head > 4 ? head - 4 : 0; i < head; i++) {
+		read_entry(ring, i % ring->nr_entries, &entry);
+		printf("  node %u %s time %llu", entry.node,
+		       entry.type ? "dmc" : "l3c",
+		       (unsigned long long)entry.time);
+		for (idx = 0; idx < TX2_PMU_MAX_COUNTERS; idx++) {
+			if (entry.counters & (1 << idx))
+				printf(" %#x:%llu", entry.config[idx],
+				       (unsigned long long)entry.count[idx]);
+		}
+		printf("\n");
+	}
+
+	munmap((void *)ring, len);
+	close(fd);
+}
+
+/* Map <pmu>/@file of @dir read-only, NULL if it does not exist */
+static void *map_pmu_file(const char *dir, const char *pmu, const char *file,
+		size_t len)
+{
+	char path[512], what[512];
+	void *p;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", dir, pmu, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	snprintf(what, sizeof(what), "%s/%s: read-only mapping", pmu, file);
+	check(p != MAP_FAILED, what);
+	snprintf(what, sizeof(what), "%s/%s", pmu, file);
+	check_readonly(fd, len, what);
+	close(fd);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void check_pmu(const char *dir, const char *pmu)
+{
+	struct tx2_user_state *state;
+	struct tx2_user_counter cntr[TX2_PMU_MAX_COUNTERS];
+	uint32_t regs[TX2_PMU_MAX_COUNTERS];
+	uint32_t seq, prorate;
+	size_t len = sysconf(_SC_PAGESIZE);
+	const volatile char *page;
+	int idx;
+
+	state = map_pmu_file(dir, pmu, "state", len);
+	if (!state)
+		return;
+	page = map_pmu_file(dir, pmu, "regs", len);
+	if (!page) {
+		munmap(state, len);
+		return;
+	}
+
+	/* see thunderx2-pmu.txt, the counters change while seq is odd */
+	do {
+		seq = READ_ONCE(state->seq);
+		rmb();
+		prorate = state->prorate;
+		memcpy(cntr, state->counters, sizeof(cntr));
+		for (idx = 0; idx < TX2_PMU_MAX_COUNTERS; idx++)
+			regs[idx] = cntr[idx].active && cntr[idx].reg < len ?
+				*(const volatile uint32_t *)(page + cntr[idx].reg) : 0;
+		rmb();
+	} while ((seq & 1) || seq != READ_ONCE(state->seq));
+
+	/* only events of channel 0 are active, scope is 0 or 1 */
+	printf("%s: seq %u prorate %u\n", pmu, seq, prorate);
+	for (idx = 0; idx < TX2_PMU_MAX_COUNTERS; idx++) {
+		if (!cntr[idx].active)
+			continue;
+		printf("  counter %d config %#x count %llu\n", idx,
+		       cntr[idx].config, (unsigned long long)(cntr[idx].count +
+		       (uint64_t)(uint32_t)(regs[idx] - cntr[idx].raw) *
+		       (GET_SCOPE(cntr[idx].config) ? 1 : prorate)));
+	}
+
+	munmap((void *)page, len);
+	munmap(state, len);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : "/sys/kernel/debug/thunderx2_pmu";
+	struct dirent *d;
+	DIR *pmus;
+
+	check_snapshots(dir);
+
+	pmus = opendir(dir);
+	if (pmus) {
+		while ((d = readdir(pmus)))
+			if (d->d_type == DT_DIR && d->d_name[0] != '.')
+				check_pmu(dir, d->d_name);
+		closedir(pmus);
+	}
+	return failures ? 1 : 0;
+}